@@ -0,0 +1,36 @@
+#include "../src/process.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+using namespace process;
+using Clock = std::chrono::steady_clock;
+
+// Cost of an orchestration loop of short captured commands run for real,
+// under the recorder, and replayed from the trace without delays.
+static double run(int count) {
+  auto start = Clock::now();
+  for (int i = 0; i < count; i += 1)
+    Command("echo").arg(std::to_string(i)).output();
+  std::chrono::duration<double, std::micro> elapsed = Clock::now() - start;
+  return elapsed.count() / count;
+}
+
+int main(int argc, char *argv[]) {
+  int count = argc > 1 ? std::stoi(argv[1]) : 1000;
+  std::string trace = argc > 2 ? argv[2] : "/tmp/bench_backend.trace";
+
+  double real = run(count);
+  Backend::install(std::make_shared<RecordingBackend>(trace));
+  double recording = run(count);
+  Backend::install(nullptr); // finishes the trace
+  Backend::install(std::make_shared<ReplayBackend>(trace, 0));
+  double replay = run(count);
+  Backend::install(nullptr);
+  std::remove(trace.c_str());
+
+  std::cout << count << " commands: real " << real << " us, recording "
+            << recording << " us, replay " << replay << " us per command\n";
+}
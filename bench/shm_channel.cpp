@@ -0,0 +1,84 @@
+#include "../src/process.hpp"
+#include "../src/shm_channel.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace process;
+using Clock = std::chrono::steady_clock;
+
+// Throughput of streaming a child's output through a pipe and through a
+// shared-memory channel. The benchmark re-executes itself as the producer.
+static constexpr size_t chunk = 64 * 1024;
+
+static int produce(const std::string &mode, size_t total) {
+  std::vector<std::byte> block(chunk, std::byte{'x'});
+  if (mode == "shm") {
+    shm::Writer out(STDOUT_FILENO);
+    for (size_t sent = 0; sent < total; sent += chunk)
+      out.write(block);
+    return 0;
+  }
+  for (size_t sent = 0; sent < total; sent += chunk) {
+    for (size_t done = 0; done < chunk;) {
+      ssize_t written = ::write(STDOUT_FILENO, block.data() + done, chunk - done);
+      if (written <= 0)
+        return 1;
+      done += written;
+    }
+  }
+  return 0;
+}
+
+static double consume(const std::string &self, const std::string &mode,
+                      size_t total, size_t ring) {
+  std::vector<std::byte> buffer(chunk);
+  auto start = Clock::now();
+  size_t received = 0;
+  if (mode == "shm") {
+    Child child = Command(self)
+                      .args({"produce", mode, std::to_string(total)})
+                      .std_out(Stdio::shm_channel(ring))
+                      .spawn();
+    shm::Reader in(child.io_stdout->native_handle());
+    while (size_t got = in.read(buffer))
+      received += got;
+    child.wait();
+  } else {
+    Child child = Command(self)
+                      .args({"produce", mode, std::to_string(total)})
+                      .std_out(Stdio::pipe())
+                      .spawn();
+    while (size_t got = child.io_stdout->read(buffer))
+      received += got;
+    child.wait();
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  if (received != total)
+    std::cerr << mode << ": received " << received << " of " << total << "\n";
+  return total / elapsed.count() / (1 << 30);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc == 4 && std::string(argv[1]) == "produce")
+    return produce(argv[2], std::stoull(argv[3]));
+
+  size_t total = (argc > 1 ? std::stoull(argv[1]) : 4096) << 20; // MiB
+  size_t ring = (argc > 2 ? std::stoull(argv[2]) : 4) << 20;      // MiB
+  int rounds = argc > 3 ? std::stoi(argv[3]) : 3;
+  std::string self = "/proc/self/exe";
+  char path[4096];
+  ssize_t len = readlink(self.c_str(), path, sizeof(path) - 1);
+  if (len > 0)
+    self.assign(path, len);
+
+  for (int round = 0; round < rounds; round += 1) {
+    double pipe = consume(self, "pipe", total, ring);
+    double shm = consume(self, "shm", total, ring);
+    std::cout << (total >> 20) << " MiB: pipe " << pipe << " GiB/s, shm channel "
+              << shm << " GiB/s\n";
+  }
+}
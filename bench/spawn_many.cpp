@@ -0,0 +1,45 @@
+#include "../src/process.hpp"
+
+#include <chrono>
+#include <iostream>
+
+using namespace process;
+using Clock = std::chrono::steady_clock;
+
+static std::vector<Command> make_commands(size_t count) {
+  std::vector<Command> commands;
+  for (size_t i = 0; i < count; i += 1)
+    commands.push_back(Command("true")
+                           .env("BENCH_ID", std::to_string(i % 4))
+                           .std_out(Stdio::pipe())
+                           .std_err(Stdio::pipe()));
+  return commands;
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = argc > 1 ? std::stoul(argv[1]) : 500;
+  int rounds = argc > 2 ? std::stoi(argv[2]) : 5;
+
+  for (int round = 0; round < rounds; round += 1) {
+    auto commands = make_commands(count);
+    auto start = Clock::now();
+    std::vector<Child> children;
+    for (auto &command : commands)
+      children.push_back(command.spawn());
+    auto spawned = Clock::now();
+    for (auto &child : children)
+      child.wait();
+    std::chrono::duration<double, std::milli> loop = spawned - start;
+
+    commands = make_commands(count);
+    start = Clock::now();
+    children = spawn_many(commands);
+    spawned = Clock::now();
+    for (auto &child : children)
+      child.wait();
+    std::chrono::duration<double, std::milli> batch = spawned - start;
+
+    std::cout << count << " children: spawn() loop " << loop.count()
+              << " ms, spawn_many " << batch.count() << " ms\n";
+  }
+}
@@ -0,0 +1,47 @@
+#include "../src/process.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+using namespace process;
+using Clock = std::chrono::steady_clock;
+
+// Spawn cost of a fixed `sh -c` command line built at runtime through
+// Command versus laid out at compile time through StaticCommand, with the
+// heap allocations each spawn makes.
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+template <class Spawn> static void measure(const char *name, int count, Spawn spawn) {
+  size_t before = allocations.load();
+  auto start = Clock::now();
+  for (int i = 0; i < count; i += 1)
+    spawn();
+  std::chrono::duration<double, std::micro> elapsed = Clock::now() - start;
+  std::cout << name << ": " << elapsed.count() / count << " us/spawn, "
+            << double(allocations.load() - before) / count << " allocations/spawn\n";
+}
+
+int main(int argc, char *argv[]) {
+  int count = argc > 1 ? std::atoi(argv[1]) : 2000;
+  int rounds = argc > 2 ? std::atoi(argv[2]) : 3;
+  for (int round = 0; round < rounds; round += 1) {
+    measure("Command(\"sh\").arg(...)", count, [] {
+      Command("sh").arg("-c").arg("exit 0").status();
+    });
+    measure("StaticCommand<\"sh\", ...>", count, [] {
+      StaticCommand<"sh", "-c", "exit 0">::status();
+    });
+  }
+}
@@ -0,0 +1,73 @@
+#include "../src/process.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+using namespace process;
+using Clock = std::chrono::steady_clock;
+
+// Throughput of feeding a page-aligned buffer to a child's stdin with
+// ChildStdin::write and with ChildStdin::write_zero_copy. The benchmark
+// re-executes itself as the consumer, which splices its stdin into
+// /dev/null so that the consumer side copies nothing either way.
+static int consume() {
+  int null = open("/dev/null", O_WRONLY);
+  while (splice(STDIN_FILENO, nullptr, null, nullptr, 1 << 20, SPLICE_F_MOVE) > 0) {
+  }
+  return 0;
+}
+
+static double feed(const std::string &self, const std::string &mode,
+                   const std::byte *buffer, size_t size, int repeat) {
+  Child child = Command(self).arg("consume").std_in(Stdio::pipe()).spawn();
+  // a larger pipe lets more pages be in flight per call
+  fcntl(child.io_stdin->native_handle(), F_SETPIPE_SZ, 1 << 20);
+  auto start = Clock::now();
+  {
+    ChildStdin in = std::move(*child.io_stdin);
+    std::span data{buffer, size};
+    for (int round = 0; round < repeat; round += 1) {
+      if (mode == "zero-copy") {
+        in.write_zero_copy(data);
+      } else {
+        for (auto rest = data; not rest.empty();)
+          rest = rest.subspan(in.write(rest));
+      }
+    }
+  }
+  // the buffer may only be reused once the child has drained the pipe
+  child.wait();
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  return double(size) * repeat / elapsed.count() / (1 << 30);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc == 2 && std::string(argv[1]) == "consume")
+    return consume();
+
+  size_t size = (argc > 1 ? std::stoull(argv[1]) : 256) << 20; // MiB
+  int repeat = argc > 2 ? std::stoi(argv[2]) : 8;
+  int rounds = argc > 3 ? std::stoi(argv[3]) : 3;
+  std::string self = "/proc/self/exe";
+  char path[4096];
+  ssize_t len = readlink(self.c_str(), path, sizeof(path) - 1);
+  if (len > 0)
+    self.assign(path, len);
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  auto *buffer = static_cast<std::byte *>(std::aligned_alloc(page, size));
+  for (size_t i = 0; i < size; i += page)
+    buffer[i] = std::byte{1}; // fault every page in up front
+
+  for (int round = 0; round < rounds; round += 1) {
+    double copy = feed(self, "write", buffer, size, repeat);
+    double zero = feed(self, "zero-copy", buffer, size, repeat);
+    std::cout << (size >> 20) << " MiB x " << repeat << ": write " << copy
+              << " GiB/s, write_zero_copy " << zero << " GiB/s\n";
+  }
+  std::free(buffer);
+}
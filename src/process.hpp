@@ -1,9 +1,25 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <initializer_list>
 #include <memory>
+#include <new>
 #include <optional>
+#include <ranges>
 #include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #ifdef _MSC_VER
@@ -14,6 +30,187 @@ typedef SSIZE_T ssize_t;
 namespace process {
 using std::unique_ptr;
 
+namespace detail {
+// Pimpl kept in a fixed-size buffer inside the owning object instead of on
+// the heap. The header stays opaque; members are only instantiated in the
+// translation unit where T is complete, which also checks that it fits.
+//
+// Size is part of the ABI: it fixes the layout of the public handle types.
+// Each is picked with at least 64 bytes over its Impl at the time, so later
+// members can be added without breaking compiled callers; an Impl that
+// outgrows its storage is an ABI break and fails to compile here.
+template <class T, size_t Size, size_t Align = alignof(std::max_align_t)>
+class InlineImpl {
+public:
+  InlineImpl() {
+    fits();
+    new (storage_) T();
+  }
+  InlineImpl(InlineImpl &&other) {
+    fits();
+    new (storage_) T(std::move(*other));
+  }
+  InlineImpl &operator=(InlineImpl &&other) {
+    if (this != &other)
+      **this = std::move(*other);
+    return *this;
+  }
+  ~InlineImpl() { get()->~T(); }
+
+  T *operator->() { return get(); }
+  const T *operator->() const { return get(); }
+  T &operator*() { return *get(); }
+  const T &operator*() const { return *get(); }
+
+private:
+  static constexpr void fits() {
+    static_assert(sizeof(T) <= Size,
+                  "inline impl outgrew its storage; resizing it breaks the ABI");
+    static_assert(alignof(T) <= Align, "inline impl storage misaligned");
+  }
+  T *get() { return std::launder(reinterpret_cast<T *>(storage_)); }
+  const T *get() const {
+    return std::launder(reinterpret_cast<const T *>(storage_));
+  }
+  alignas(Align) std::byte storage_[Size];
+};
+
+// string literal usable as a template argument
+template <size_t N> struct fixed_string {
+  char data[N]{};
+  constexpr fixed_string(const char (&text)[N]) {
+    for (size_t i = 0; i < N; i += 1)
+      data[i] = text[i];
+  }
+  constexpr bool nul_free() const {
+    for (size_t i = 0; i + 1 < N; i += 1)
+      if (data[i] == '\0')
+        return false;
+    return true;
+  }
+};
+
+inline const char *c_arg(const char *arg) { return arg; }
+inline const char *c_arg(const std::string &arg) { return arg.c_str(); }
+
+// Non-owning, type-erased reference to a byte callback: the primitive the
+// templated capture paths reduce to, so the loops stay out of the header.
+class SinkRef {
+public:
+  template <class F>
+    requires(not std::same_as<std::remove_cv_t<F>, SinkRef>)
+  SinkRef(F &callback)
+      : context_(&callback), write_([](void *context, std::span<const std::byte> bytes) {
+          (*static_cast<F *>(context))(bytes);
+        }) {}
+  void operator()(std::span<const std::byte> bytes) const { write_(context_, bytes); }
+
+private:
+  void *context_;
+  void (*write_)(void *, std::span<const std::byte>);
+};
+
+// contiguous-enough containers of bytes: std::string, std::vector<char>,
+// their std::pmr forms, ...
+template <class C>
+concept ByteContainer =
+    requires(C &container, const typename C::value_type *bytes) {
+      container.insert(container.end(), bytes, bytes);
+    } && sizeof(typename C::value_type) == 1 &&
+    (std::same_as<typename C::value_type, char> ||
+     std::same_as<typename C::value_type, unsigned char> ||
+     std::same_as<typename C::value_type, std::byte>);
+} // namespace detail
+
+// Where captured output can go: a byte container, appended to, or anything
+// callable with each chunk as it arrives (FixedBuffer is one).
+template <class S>
+concept OutputSink =
+    detail::ByteContainer<std::remove_cvref_t<S>> ||
+    std::invocable<std::remove_reference_t<S> &, std::span<const std::byte>>;
+
+namespace detail {
+template <class S> auto sink_writer(S &sink) {
+  if constexpr (ByteContainer<S>) {
+    return [&sink](std::span<const std::byte> bytes) {
+      auto first = reinterpret_cast<const typename S::value_type *>(bytes.data());
+      sink.insert(sink.end(), first, first + bytes.size());
+    };
+  } else {
+    return [&sink](std::span<const std::byte> bytes) { sink(bytes); };
+  }
+}
+} // namespace detail
+
+// Output sink over caller-owned memory. Bytes beyond its end are dropped,
+// while the stream is still drained so the child never blocks on it, and
+// truncated() reports the loss.
+class FixedBuffer {
+public:
+  explicit FixedBuffer(std::span<std::byte> storage) : storage_(storage) {}
+
+  void operator()(std::span<const std::byte> bytes) {
+    size_t step = std::min(storage_.size() - size_, bytes.size());
+    if (step > 0)
+      std::memcpy(storage_.data() + size_, bytes.data(), step);
+    size_ += step;
+    truncated_ = truncated_ || step < bytes.size();
+  }
+  std::span<std::byte> data() const { return storage_.first(size_); }
+  std::string_view view() const {
+    return {reinterpret_cast<const char *>(storage_.data()), size_};
+  }
+  size_t size() const { return size_; }
+  bool truncated() const { return truncated_; }
+
+private:
+  std::span<std::byte> storage_;
+  size_t size_ = 0;
+  bool truncated_ = false;
+};
+
+#ifdef _WIN32
+using native_handle_type = void *; // HANDLE
+#else
+using native_handle_type = int;
+#endif
+
+#ifndef _WIN32
+enum class IoError { WouldBlock, Eof, Error };
+
+// Outcome of a non-blocking transfer: a byte count or the reason there is
+// none. Mirrors the std::expected<size_t, IoError> interface (C++23).
+class IoResult {
+public:
+  IoResult(size_t bytes) : bytes_(bytes), error_(std::nullopt), errno_(0) {}
+  IoResult(IoError error, int os_error = 0)
+      : bytes_(0), error_(error), errno_(os_error) {}
+
+  bool has_value() const { return not error_; }
+  explicit operator bool() const { return has_value(); }
+  size_t value() const {
+    if (error_)
+      throw std::runtime_error("IoResult holds no value");
+    return bytes_;
+  }
+  size_t operator*() const { return bytes_; }
+  IoError error() const { return *error_; }
+  // errno behind IoError::Error
+  int os_error() const { return errno_; }
+
+private:
+  size_t bytes_;
+  std::optional<IoError> error_;
+  int errno_;
+};
+#endif
+
+// The child closed the read end of a pipe we were writing to.
+class BrokenPipe : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
 class ChildStdin {
 public:
   ChildStdin();
@@ -22,13 +219,26 @@ public:
   ChildStdin &operator=(ChildStdin &&other);
 
   size_t write(std::span<const std::byte> buffer);
+  native_handle_type native_handle() const;
+#ifndef _WIN32
+  void set_nonblocking(bool enable = true);
+  IoResult try_write(std::span<const std::byte> buffer);
+  // Write all of buffer, moving its whole pages into the pipe by reference
+  // (vmsplice) instead of copying them; the unaligned edges, and the whole
+  // buffer when stdin is not a pipe, are written normally. The pipe then
+  // holds the caller's pages: buffer must stay mapped and unmodified until
+  // the child has read them, e.g. until it exits or acknowledges the data.
+  // Pays off for large page-aligned buffers.
+  size_t write_zero_copy(std::span<const std::byte> buffer);
+#endif
 
 private:
   struct Impl;
-  unique_ptr<Impl> impl_;
+  detail::InlineImpl<Impl, 80> impl_;
   friend class Stdio;
   friend class Child;
   friend class Command;
+  friend class BufferedStdin;
 };
 
 class ChildStdout {
@@ -41,10 +251,28 @@ public:
   size_t read(std::span<std::byte> buffer);
   size_t read_to_end(std::vector<std::byte> &buffer);
   size_t read_to_string(std::string &buffer);
+  native_handle_type native_handle() const;
+#ifndef _WIN32
+  void set_nonblocking(bool enable = true);
+  IoResult try_read(std::span<std::byte> buffer);
+  // bytes Child::wait_for_output read ahead; reads return them before
+  // anything from the pipe, which native_handle() does not see
+  size_t buffered() const;
+  // everything up to end of stream into sink; returns the byte count
+  template <class S>
+    requires OutputSink<S>
+  size_t read_to_end(S &&sink) {
+    auto writer = detail::sink_writer(sink);
+    return read_each(detail::SinkRef(writer));
+  }
+#endif
 
 private:
+#ifndef _WIN32
+  size_t read_each(detail::SinkRef sink);
+#endif
   struct Impl;
-  unique_ptr<Impl> impl_;
+  detail::InlineImpl<Impl, 112> impl_;
   friend class Stdio;
   friend class Child;
   friend class Command;
@@ -60,10 +288,28 @@ public:
   size_t read(std::span<std::byte> buffer);
   size_t read_to_end(std::vector<std::byte> &buffer);
   size_t read_to_string(std::string &buffer);
+  native_handle_type native_handle() const;
+#ifndef _WIN32
+  void set_nonblocking(bool enable = true);
+  IoResult try_read(std::span<std::byte> buffer);
+  // bytes Child::wait_for_output read ahead; reads return them before
+  // anything from the pipe, which native_handle() does not see
+  size_t buffered() const;
+  // everything up to end of stream into sink; returns the byte count
+  template <class S>
+    requires OutputSink<S>
+  size_t read_to_end(S &&sink) {
+    auto writer = detail::sink_writer(sink);
+    return read_each(detail::SinkRef(writer));
+  }
+#endif
 
 private:
+#ifndef _WIN32
+  size_t read_each(detail::SinkRef sink);
+#endif
   struct Impl;
-  unique_ptr<Impl> impl_;
+  detail::InlineImpl<Impl, 112> impl_;
   friend class Stdio;
   friend class Child;
   friend class Command;
@@ -79,15 +325,50 @@ public:
   ~ExitStatus();
 
 private:
+  struct Impl;
+  detail::InlineImpl<Impl, 80> impl_;
+  friend class Child;
+  friend class Reaper;
+  friend class OutputCache;
+};
+
+#ifndef _WIN32
+struct PumpStats;
+
+// A captured stream that outgrew its memory threshold, held in an unlinked
+// temporary file. It can be read sequentially, at an offset, or mapped whole.
+class SpillFile {
+public:
+  ~SpillFile();
+  SpillFile(SpillFile &&other);
+  SpillFile &operator=(SpillFile &&other);
+
+  size_t size() const;
+  size_t read(std::span<std::byte> buffer);
+  size_t read_at(size_t offset, std::span<std::byte> buffer) const;
+  // mapped read-only on first use, valid as long as the SpillFile
+  std::string_view view();
+  native_handle_type native_handle() const;
+
+private:
+  explicit SpillFile(int fd);
   struct Impl;
   unique_ptr<Impl> impl_;
   friend class Child;
+  friend class Command;
+  friend PumpStats pump(SpillFile &from, int to_fd, size_t limit);
 };
+#endif
 
 struct Output {
   ExitStatus status;
   std::string std_out;
   std::string std_err;
+#ifndef _WIN32
+  // set when a stream passed the spill threshold; its string is then empty
+  std::optional<SpillFile> std_out_file;
+  std::optional<SpillFile> std_err_file;
+#endif
 };
 
 class Stdio {
@@ -96,21 +377,71 @@ public:
   Stdio(Stdio &&other);
   Stdio &operator=(Stdio &&other);
 
-  enum class Value { Inherit, NewPipe, FromPipe, Null };
+  enum class Value { Inherit, NewPipe, FromPipe, Null, ShmChannel, Tee };
   static Stdio pipe();
   static Stdio inherit();
   static Stdio null();
   static Stdio from(ChildStdin);
   static Stdio from(ChildStdout);
   static Stdio from(ChildStderr);
+#ifndef _WIN32
+  // A shared-memory ring of at least capacity bytes instead of a pipe. Both
+  // ends attach with shm::Reader / shm::Writer from shm_channel.hpp: the
+  // parent to the handle's native_handle(), the child to the stdio fd it
+  // was given. The handle's read/write calls do not apply to it.
+  static Stdio shm_channel(size_t capacity = 1 << 20);
+  // A pipe for an output stream whose contents also go to target_fd, live:
+  // a library thread duplicates them in the kernel with tee(2) and splices
+  // the copy into (a duplicate of) target_fd, so only the captured copy is
+  // ever read into user space. Forwarding stops if target_fd fails;
+  // capturing stops when our handle is dropped.
+  static Stdio tee(int target_fd);
+#endif
 
 private:
   Stdio(Value value);
   struct Impl;
-  std::unique_ptr<Impl> impl_;
+  detail::InlineImpl<Impl, 96> impl_;
   friend class Command;
 };
 
+#ifndef _WIN32
+// One sd_notify datagram from a child: its KEY=VALUE lines in order.
+struct Notification {
+  int pid = 0; // sender as the kernel reports it
+  std::vector<std::pair<std::string, std::string>> fields;
+
+  // value of the last field named key
+  std::optional<std::string> value(std::string_view key) const {
+    for (auto field = fields.rbegin(); field != fields.rend(); ++field)
+      if (field->first == key)
+        return field->second;
+    return std::nullopt;
+  }
+};
+
+// What Child::wait_for_output looks for. A literal is found anywhere in
+// the stream, also when it spans reads; a regex (ECMAScript syntax) or a
+// predicate is tried on each complete line, without its line break, and
+// on an unterminated last line once the stream ends.
+class OutputPattern {
+public:
+  OutputPattern(const char *text) : OutputPattern(literal(text)) {}
+  OutputPattern(std::string text) : OutputPattern(literal(std::move(text))) {}
+  static OutputPattern literal(std::string text);
+  static OutputPattern regex(std::string expression);
+  static OutputPattern line(std::function<bool(std::string_view)> predicate);
+
+private:
+  enum class Kind { Literal, Regex, Line };
+  OutputPattern(Kind kind) : kind_(kind) {}
+  Kind kind_;
+  std::string text_;
+  std::function<bool(std::string_view)> predicate_;
+  friend class Child;
+};
+#endif
+
 class Child {
 public:
   std::optional<ChildStdin> io_stdin;
@@ -121,19 +452,181 @@ public:
   Child(Child &&other);
   Child &operator=(Child &&other);
 
+  // process id; -1 for a child that a backend only simulates
   int id();
   void kill();
   Output wait_with_output();
   ExitStatus wait();
   void try_wait();
+#ifndef _WIN32
+  // exit status delivered by the central reaper instead of a blocked thread
+  std::future<ExitStatus> wait_async();
+  // SIGTERM the child's process group (or the child alone when it does not
+  // lead one), wait up to grace for it to exit, then SIGKILL what is left
+  ExitStatus terminate_tree(std::chrono::milliseconds grace);
+  // keep at most spill_threshold bytes of each stream in memory, moving the
+  // rest to a temporary file in directory ($TMPDIR or /tmp when empty)
+  Output wait_with_output(size_t spill_threshold,
+                          const std::string &directory = "");
+  // Read the piped ones of stdout and stderr until pattern shows up, and
+  // return the line it is on; nothing after timeout or once both streams
+  // ended without it. What is read stays buffered in the handles for their
+  // reads and wait_with_output. A later call resumes on the line after the
+  // match, for literals and line patterns alike; a match on a line not yet
+  // terminated consumes only what was read of it.
+  std::optional<std::string> wait_for_output(const OutputPattern &pattern,
+                                             std::chrono::milliseconds timeout);
+  // With Command::notify_socket(): wait for the child to send READY=1;
+  // false on timeout or when it exits first. Notifications that arrive
+  // meanwhile stay queued for next_notification.
+  bool wait_ready(std::chrono::milliseconds timeout);
+  // the next notification (STATUS=, WATCHDOG=, ...), nothing on timeout or
+  // once the child has exited and none are left
+  std::optional<Notification> next_notification(std::chrono::milliseconds timeout);
+  // Without blocking: whether the child's watchdog ran out, i.e. it sent
+  // WATCHDOG=trigger or no WATCHDOG=1 arrived within its interval (set by
+  // notify_socket or by the child with WATCHDOG_USEC=). Kill it if so.
+  bool watchdog_expired();
+  // parent end of a pipe set up with Command::extra_in / extra_out, by the
+  // child fd it was given to; empty when there is none or it was taken
+  std::optional<ChildStdin> take_in(int child_fd);
+  std::optional<ChildStdout> take_out(int child_fd);
+  // drain stdout and stderr straight into the sinks, then wait; a stream
+  // that is not piped leaves its sink untouched
+  template <class Out, class Err>
+    requires OutputSink<Out> && OutputSink<Err>
+  ExitStatus wait_with_output(Out &&out, Err &&err) {
+    auto out_writer = detail::sink_writer(out);
+    auto err_writer = detail::sink_writer(err);
+    return wait_each(detail::SinkRef(out_writer), detail::SinkRef(err_writer));
+  }
+#endif
 
 private:
   Child();
+#ifndef _WIN32
+  ExitStatus wait_each(detail::SinkRef out, detail::SinkRef err);
+#endif
   struct Impl;
-  unique_ptr<Impl> impl_;
+  detail::InlineImpl<Impl, 160> impl_;
   friend class Command;
+#ifndef _WIN32
+  friend class Backend;
+  friend class Graph;
+#endif
+};
+
+#ifndef _WIN32
+enum class MemPolicy { Default, Preferred, Bind, Interleave };
+enum class SchedPolicy { Other, Batch, Idle };
+enum class IoPriority { None, RealTime, BestEffort, Idle };
+#endif
+
+#ifndef _WIN32
+// Buffered writer over a child's stdin. Small writes are collected and sent
+// with as few syscalls as possible; large ones go straight out together
+// with the pending buffer in a single gather write. Writes never raise
+// SIGPIPE: a closed pipe surfaces as BrokenPipe. Pending data is flushed
+// on destruction, where errors are ignored.
+class BufferedStdin {
+public:
+  explicit BufferedStdin(ChildStdin inner, size_t capacity = 64 * 1024);
+  ~BufferedStdin();
+  BufferedStdin(BufferedStdin &&other);
+  BufferedStdin &operator=(BufferedStdin &&other);
+
+  size_t write(std::span<const std::byte> buffer);
+  void write_all(std::span<const std::byte> buffer);
+  void writev(std::span<const std::span<const std::byte>> buffers);
+  void flush();
+  // flush and close the pipe so the child sees end of input
+  void close();
+  ChildStdin into_inner();
+
+private:
+  ChildStdin inner_;
+  std::vector<std::byte> buffer_;
+  size_t capacity_;
+};
+
+struct PumpStats {
+  size_t bytes = 0;  // moved from source to destination
+  size_t copied = 0; // of those, bytes that went through a user-space buffer
+  size_t calls = 0;  // transfer system calls
+  std::chrono::nanoseconds elapsed{};
 };
 
+// Relay a child's stdout into another fd until end of stream or limit
+// bytes. The kernel moves the data with splice(2); when the destination
+// does not support that (e.g. a file opened with O_APPEND) the rest goes
+// through read and write. A closed destination pipe surfaces as
+// BrokenPipe. Both ends must be in blocking mode.
+PumpStats pump(ChildStdout &from, int to_fd, size_t limit = SIZE_MAX);
+PumpStats pump(ChildStdout &from, ChildStdin &to, size_t limit = SIZE_MAX);
+// Relay the rest of a spilled output from its read position, which moves
+// past what was sent. sendfile(2) takes the bytes straight from the page
+// cache, with read and write as the fallback as above.
+PumpStats pump(SpillFile &from, int to_fd, size_t limit = SIZE_MAX);
+PumpStats pump(SpillFile &from, ChildStdin &to, size_t limit = SIZE_MAX);
+// The same on a library thread that owns the handles; the destination
+// stdin is closed once done so the next child sees end of input. to_fd
+// stays the caller's and must remain open until the future is ready. The
+// future owns the thread: destroying it waits for the pump to finish.
+std::future<PumpStats> pump_async(ChildStdout from, int to_fd,
+                                  size_t limit = SIZE_MAX);
+std::future<PumpStats> pump_async(ChildStdout from, ChildStdin to,
+                                  size_t limit = SIZE_MAX);
+
+// Opt-in on-disk cache of Output for deterministic commands. Entries are
+// content addressed by a key built from the program, arguments, working
+// directory, selected environment variables and the contents of declared
+// input files; they are read back through mmap and the least recently used
+// ones are evicted once the directory grows past max_bytes.
+class OutputCache {
+public:
+  explicit OutputCache(const std::string &directory,
+                       size_t max_bytes = 256 * 1024 * 1024);
+  ~OutputCache();
+  OutputCache(OutputCache &&other);
+  OutputCache &operator=(OutputCache &&other);
+
+  std::optional<Output> lookup(const std::string &key);
+  void store(const std::string &key, const Output &output);
+  size_t size_bytes() const;
+  void clear();
+
+private:
+  struct Impl;
+  unique_ptr<Impl> impl_;
+};
+
+// Central reaper: a single thread that watches children through a pidfd
+// epoll set and reaps them in batches as they exit. Children are handed to
+// it by Child::wait_async, or all of them once start() has been called, so
+// a child nobody waits on does not linger as a zombie.
+class Reaper {
+public:
+  static void start();
+  static bool running();
+
+private:
+  struct Impl;
+  friend class Child;
+};
+#endif
+
+#ifndef _WIN32
+template <detail::fixed_string App, detail::fixed_string... Args>
+class StaticCommand;
+
+// how for_each_batch packs and runs its invocations
+struct BatchOptions {
+  size_t max_args = 0;    // arguments per invocation, 0: as many as fit
+  size_t max_bytes = 0;   // argv and environment size, 0: the system limit
+  size_t parallelism = 0; // invocations running at once, 0: one per cpu
+};
+#endif
+
 class Command {
 public:
   Command(const std::string &app = std::string());
@@ -141,20 +634,560 @@ public:
   Command(Command &&other);            // move ctor
   Command &operator=(Command &&other); // move assignment
 
-  Command &&arg(const std::string &arg);
-  Command &&args(const std::vector<std::string> &args);
+  Command &&arg(std::string_view arg);
+  Command &&args(std::initializer_list<std::string_view> args);
+  // any range of string-like values: vector<string>, const char *[], span...
+  template <std::ranges::input_range R>
+    requires std::convertible_to<std::ranges::range_reference_t<R>,
+                                 std::string_view>
+  Command &&args(R &&args) {
+    for (auto &&arg : args)
+      this->arg(std::string_view(arg));
+    return std::move(*this);
+  }
   Command &&std_in(Stdio io);
   Command &&std_out(Stdio io);
   Command &&std_err(Stdio io);
   Command &&current_dir(const std::string &path);
   Command &&env(const std::string &key, const std::string &value);
   Command &&env_clear();
+#ifndef _WIN32
+  // scheduling and placement, applied in the child before exec
+  Command &&cpu_affinity(const std::vector<int> &cpus);
+  Command &&mem_policy(MemPolicy policy, const std::vector<int> &nodes = {});
+  Command &&nice(int increment);
+  Command &&sched_policy(SchedPolicy policy);
+  Command &&ioprio(IoPriority io_class, int level = 4);
+  // process tree control
+  Command &&process_group(bool enable = true);
+  Command &&new_session(bool enable = true);
+  Command &&parent_death_signal(int signal);
+  // serve output() from a cache; variables set with env() are always in the
+  // key, inherited ones and input files are opted into it
+  Command &&cache(OutputCache &cache);
+  Command &&cache_env(std::string_view key);
+  Command &&cache_input(std::string_view path);
+  // captured streams past bytes go to a temporary file, see Output
+  Command &&spill_threshold(size_t bytes, const std::string &directory = "");
+  // Extra fds for the child. pass_fd duplicates one of ours, which must stay
+  // open until the spawn, onto child_fd. extra_in / extra_out set child_fd
+  // up the way stdin / stdout would be, reading or writing respectively;
+  // the parent end of a pipe is claimed with Child::take_in / take_out. All
+  // mappings, stdio included, are applied together in the child, so they
+  // may overlap or swap; for the same child_fd the last one wins.
+  Command &&pass_fd(int parent_fd, int child_fd);
+  Command &&extra_in(int child_fd, Stdio io);
+  Command &&extra_out(int child_fd, Stdio io);
+  // Speak the sd_notify protocol with the child: NOTIFY_SOCKET names a
+  // fresh abstract-namespace datagram socket per spawn that only we read,
+  // see Child::wait_ready. A non-zero watchdog is passed as WATCHDOG_USEC,
+  // asking the child for WATCHDOG=1 heartbeats at least that often.
+  Command &&notify_socket(std::chrono::microseconds watchdog = {});
+#endif
   ExitStatus status();
   Output output();
+#ifndef _WIN32
+  // Feed input to a piped stdin while draining stdout/stderr concurrently,
+  // then close stdin and wait. The source overload is called with a buffer
+  // to fill and returns the number of bytes written into it, 0 at the end.
+  Output output_with_input(std::span<const std::byte> input);
+  Output output_with_input(
+      const std::function<size_t(std::span<std::byte>)> &source);
+  // output() with stdout and stderr going straight into the sinks
+  template <class Out, class Err>
+    requires OutputSink<Out> && OutputSink<Err>
+  ExitStatus output(Out &&out, Err &&err) {
+    return spawn_captured().wait_with_output(out, err);
+  }
+#endif
   Child spawn();
 
 private:
   class Impl;
   unique_ptr<Impl> impl_;
+#ifndef _WIN32
+  friend std::vector<Child> spawn_many(std::span<Command> commands);
+  friend std::vector<Output> for_each_batch(Command command,
+                                            std::span<const std::string_view> args,
+                                            BatchOptions options);
+
+  // fork and exec a ready argv with inherited stdio, or stdout and stderr
+  // piped when capturing; nothing is copied or allocated on the way
+  static Child spawn_argv(const char *const *argv, bool capture);
+  // spawn with stdout and stderr piped unless set otherwise
+  Child spawn_captured();
+  template <detail::fixed_string App, detail::fixed_string... Args>
+  friend class StaticCommand;
+  friend class Backend;
+  friend class SpawnRequest;
+#endif
+};
+
+#ifndef _WIN32
+// A command line fixed at compile time. The argument strings and the argv
+// pointer array are constants, and arguments appended per call (C strings
+// or std::string) are referenced in place, so a spawn builds no strings and
+// allocates nothing. Stdio is inherited, except that output() captures
+// stdout and stderr as Command::output() does.
+//
+//   using Probe = StaticCommand<"sh", "-c", "exec curl -sf \"$0\"">;
+//   bool up = Probe::status(url).success();
+template <detail::fixed_string App, detail::fixed_string... Args>
+class StaticCommand {
+  static_assert(App.nul_free() && (Args.nul_free() && ...),
+                "arguments cannot contain nul bytes");
+
+public:
+  static constexpr const char *argv[] = {App.data, Args.data..., nullptr};
+
+  template <class... Tail> static Child spawn(const Tail &...tail) {
+    return launch(false, tail...);
+  }
+  template <class... Tail> static ExitStatus status(const Tail &...tail) {
+    return launch(false, tail...).wait();
+  }
+  template <class... Tail> static Output output(const Tail &...tail) {
+    return launch(true, tail...).wait_with_output();
+  }
+
+private:
+  template <class... Tail>
+  static Child launch(bool capture, const Tail &...tail) {
+    if constexpr (sizeof...(Tail) == 0) {
+      return Command::spawn_argv(argv, capture);
+    } else {
+      const char *full[] = {App.data, Args.data..., detail::c_arg(tail)...,
+                            nullptr};
+      return Command::spawn_argv(full, capture);
+    }
+  }
+};
+#endif
+
+#ifndef _WIN32
+// Spawn a batch of commands: every pipe is created up front, commands with
+// the same program and environment share one resolved executable path and
+// envp, and the forks are issued back to back. All or nothing: if any
+// command fails to start, the ones already started are killed and reaped
+// before the error is rethrown.
+std::vector<Child> spawn_many(std::span<Command> commands);
+#endif
+
+#ifndef _WIN32
+// Run command with args appended to its own arguments, packed like xargs
+// into as few invocations as fit: the strings of argv and the environment
+// plus their pointer arrays, as execve copies them, stay within ARG_MAX
+// less 2048 bytes of headroom (or max_bytes). Each invocation's output is
+// captured as by Command::output(); the Outputs come back in batch order.
+// A batch that fails does not stop the others; one that cannot be started
+// throws once the running ones have finished.
+std::vector<Output> for_each_batch(Command command,
+                                   std::span<const std::string_view> args,
+                                   BatchOptions options = {});
+template <std::ranges::input_range Range>
+  requires std::convertible_to<std::ranges::range_reference_t<Range>,
+                               std::string_view>
+std::vector<Output> for_each_batch(Command command, Range &&args,
+                                   BatchOptions options = {}) {
+  using Ref = std::ranges::range_reference_t<Range>;
+  std::vector<std::string_view> views;
+  std::vector<std::string> owned; // for ranges that make their elements
+  for (auto &&arg : args) {
+    if constexpr (std::is_lvalue_reference_v<Ref>)
+      views.emplace_back(arg);
+    else
+      owned.emplace_back(std::string_view(arg));
+  }
+  views.insert(views.end(), owned.begin(), owned.end());
+  return for_each_batch(std::move(command),
+                        std::span<const std::string_view>(views), options);
+}
+#endif
+
+#ifndef _WIN32
+// What Command asks a Backend to start. Only streams set up as new pipes
+// come back to the caller as handles.
+class SpawnRequest {
+public:
+  std::vector<std::string> argv; // program first
+  std::optional<std::string> cwd;
+  bool piped[3] = {}; // stdin, stdout, stderr
+
+private:
+  Command::Impl *command_ = nullptr;
+  friend class Backend;
+  friend class Command;
+};
+
+// Where Command sends its children: spawn() and everything built on it
+// (status, output, output_with_input) go through the installed backend, or
+// straight to fork and exec when there is none. Child handles stay fds, so
+// a backend that observes or simulates a child's I/O does it at the far end
+// of the pipes it hands out. spawn_many and StaticCommand always fork.
+class Backend : public std::enable_shared_from_this<Backend> {
+public:
+  virtual ~Backend() = default;
+  virtual Child spawn(const SpawnRequest &request) = 0;
+  // for children made with adopt(): the exit code, none when killed
+  virtual std::optional<int> wait(int id) = 0;
+  virtual void kill(int id) = 0;
+  // the handle of an adopted child went away before it was waited for; a
+  // backend drops what it keeps for id. Nothing to do by default.
+  virtual void release(int) {}
+
+  // used by every later spawn in the process; nullptr uninstalls
+  static void install(std::shared_ptr<Backend> backend);
+  static std::shared_ptr<Backend> installed();
+
+protected:
+  // fork and exec exactly as Command does without a backend
+  static Child spawn_unix(const SpawnRequest &request);
+  // a Child over our ends of its pipes (-1 where not piped) whose wait and
+  // kill come back to this backend with id; pid is the real process behind
+  // it, which Child::id() reports, or -1 when there is none
+  Child adopt(int id, const int (&fds)[3], int pid = -1);
+  // take the fds out of child's stdio handles, -1 where it has none
+  static void release_stdio(Child &child, int (&fds)[3]);
+};
+
+// the real thing: every child is a process of its own
+class UnixBackend : public Backend {
+public:
+  UnixBackend();
+  ~UnixBackend();
+  Child spawn(const SpawnRequest &request) override { return spawn_unix(request); }
+  // for children handed out with adopt(Child)
+  std::optional<int> wait(int id) override;
+  void kill(int id) override;
+  void release(int id) override;
+
+protected:
+  using Backend::adopt;
+  // hand out a real child (from spawn_unix) whose wait and kill come back
+  // here, keyed by its pid, e.g. for a subclass that observes them
+  Child adopt(Child real);
+
+private:
+  struct Impl;
+  unique_ptr<Impl> impl_;
+};
+
+// Runs children through an inner backend and records each spawn, every
+// chunk of piped I/O and each exit, stamped with the time since the
+// recorder was created, to a compact binary trace. Records are flushed as
+// they are made, so the trace covers every child waited for so far.
+class RecordingBackend : public Backend {
+public:
+  explicit RecordingBackend(
+      const std::string &path,
+      std::shared_ptr<Backend> inner = std::make_shared<UnixBackend>());
+  ~RecordingBackend();
+  Child spawn(const SpawnRequest &request) override;
+  std::optional<int> wait(int id) override;
+  void kill(int id) override;
+  void release(int id) override;
+
+private:
+  struct Impl;
+  std::shared_ptr<Impl> impl_;
+};
+
+// Simulates the children of a recorded trace without starting processes.
+// A spawn takes the next unplayed run with the same argv and plays its
+// output back on pipes at the recorded pace divided by speed (0: without
+// delays); wait returns the recorded exit. Input is read and discarded. A
+// spawn with no recorded run left throws.
+class ReplayBackend : public Backend {
+public:
+  explicit ReplayBackend(const std::string &path, double speed = 1.0);
+  ~ReplayBackend();
+  Child spawn(const SpawnRequest &request) override;
+  std::optional<int> wait(int id) override;
+  void kill(int id) override;
+  void release(int id) override;
+
+private:
+  struct Impl;
+  unique_ptr<Impl> impl_;
+};
+#endif
+
+#ifndef _WIN32
+// Become a child subreaper: orphaned descendants of our children are
+// reparented to this process, so terminate_tree can reap them as well.
+void set_child_subreaper(bool enable = true);
+
+// online NUMA node ids, {0} when the system exposes no topology
+std::vector<int> numa_nodes();
+// cpus belonging to a NUMA node
+std::vector<int> numa_node_cpus(int node);
+
+// Spread commands round-robin across NUMA nodes: each placed command is
+// pinned to the cpus of the next node and binds its memory there.
+class NumaSpread {
+public:
+  NumaSpread();
+  explicit NumaSpread(std::vector<int> nodes);
+
+  const std::vector<int> &nodes() const { return nodes_; }
+  Command &&place(Command &&cmd);
+
+private:
+  std::vector<int> nodes_;
+  std::vector<std::vector<int>> cpus_;
+  std::atomic<size_t> next_;
+};
+
+enum class Framing {
+  Line,          // one request per line; the payload must not hold '\n'
+  LengthPrefixed // 4-byte big-endian length, then the payload
+};
+
+// Long-lived children built from one Command, each serving framed requests
+// on its stdin and answering with framed responses on its stdout. A request
+// goes to an idle worker, waiting for one if all are busy; request() may be
+// called from several threads. A worker that fails mid-request is replaced
+// and the request throws. With max_requests set, a worker is also replaced
+// after serving that many; should the replacement fail to start, the next
+// request on its slot retries and throws, not the one already answered.
+// Retiring a worker, and destroying the pool, closes its stdin and kills it
+// if it has not exited a second later.
+class WorkerPool {
+public:
+  WorkerPool(Command command, size_t workers, Framing framing = Framing::Line,
+             size_t max_requests = 0);
+  ~WorkerPool();
+  WorkerPool(WorkerPool &&other);
+  WorkerPool &operator=(WorkerPool &&other);
+
+  std::string request(std::string_view payload);
+  size_t size() const;
+  // workers started to replace crashed or retired ones
+  size_t respawns() const;
+
+private:
+  struct Impl;
+  unique_ptr<Impl> impl_;
+};
+
+enum class NodeState { Pending, Succeeded, Failed, Cancelled };
+
+struct NodeResult {
+  NodeState state = NodeState::Pending;
+  std::optional<int> exit_code; // none when killed, not started or cancelled
+  std::chrono::steady_clock::time_point started;
+  std::chrono::steady_clock::time_point finished;
+  std::chrono::steady_clock::duration elapsed() const {
+    return finished - started;
+  }
+};
+
+// A graph of commands run with bounded parallelism. depends() orders two
+// nodes: the later one starts only after the earlier one succeeded. pipe()
+// connects one node's stdout to another's stdin; nodes joined by pipes run
+// together as one unit. Among runnable units the one heading the longest
+// remaining chain of costs goes first. When a node fails, everything that
+// depends on it is cancelled while unrelated work carries on. A pipeline
+// member that cannot be started fails its whole unit: the members before
+// it are killed and those after it are not started.
+class Graph {
+public:
+  using Node = size_t;
+
+  Graph();
+  ~Graph();
+  Graph(Graph &&other);
+  Graph &operator=(Graph &&other);
+
+  // cost estimates the node's run time, only used to rank the critical path
+  Node add(Command command,
+           std::chrono::milliseconds cost = std::chrono::milliseconds(1));
+  void depends(Node later, Node earlier);
+  void pipe(Node from, Node to);
+  // parallelism 0 uses one slot per hardware thread; results by node
+  std::vector<NodeResult> run(size_t parallelism = 0);
+
+private:
+  struct Impl;
+  unique_ptr<Impl> impl_;
+};
+
+namespace detail {
+// pieces of spawn_fn that live in the translation unit
+struct ForkedFn {
+  int pid;
+  int report; // read end of the child's report pipe
+};
+// fork; the child pins itself to cpus (when given), calls run with the
+// write end of the report pipe, reports an escaping exception there and
+// _exits without unwinding into the parent's state
+ForkedFn fork_fn(const std::vector<int> &cpus, void (*run)(void *, int),
+                 void *context);
+void *map_shared(size_t size);
+void unmap_shared(void *region, size_t size);
+void write_report(int fd, char tag, std::span<const std::byte> payload);
+std::string read_report(int fd); // everything up to end of stream, then closes fd
+void close_fd(int fd);
+// reap; the exit code, or nothing when a signal ended the child
+std::optional<int> reap_fn(int pid, bool kill_first);
+size_t cpu_count();
+
+template <class T> struct is_vector : std::false_type {};
+template <class T, class A> struct is_vector<std::vector<T, A>> : std::true_type {};
+
+// results the child can hand back: trivially copyable values through a
+// shared mapping, strings and vectors of trivially copyable elements
+// serialized over the report pipe
+template <class R>
+concept FnResult =
+    std::is_void_v<R> || std::is_trivially_copyable_v<R> ||
+    std::same_as<R, std::string> ||
+    (is_vector<R>::value && std::is_trivially_copyable_v<typename R::value_type>);
+} // namespace detail
+
+struct FnOptions {
+  std::vector<int> cpus; // affinity of the child, empty to inherit ours
 };
+
+// A callable running in a forked child. get() waits for it and returns its
+// result, or throws if it threw, exited early or was killed. Dropping an
+// FnChild before get() kills and reaps the child.
+template <class R> class FnChild {
+  static constexpr bool shared = not std::is_void_v<R> &&
+                                 std::is_trivially_copyable_v<R> &&
+                                 not std::same_as<R, std::string> &&
+                                 not detail::is_vector<R>::value;
+  using Stored = std::conditional_t<shared, R, char>;
+  struct Slot {
+    alignas(Stored) unsigned char value[sizeof(Stored)];
+  };
+
+public:
+  template <class F>
+  FnChild(const FnOptions &options, F &&fn) {
+    if constexpr (shared)
+      slot_ = static_cast<Slot *>(detail::map_shared(sizeof(Slot)));
+    auto run = [&](int report) {
+      if constexpr (std::is_void_v<R>) {
+        fn();
+      } else if constexpr (shared) {
+        R result = fn();
+        std::memcpy(slot_->value, &result, sizeof(R));
+      } else {
+        R result = fn();
+        detail::write_report(report, 'R', std::as_bytes(std::span{result}));
+      }
+    };
+    try {
+      forked_ = detail::fork_fn(
+          options.cpus,
+          [](void *context, int report) { (*static_cast<decltype(run) *>(context))(report); },
+          &run);
+    } catch (...) {
+      release();
+      throw;
+    }
+  }
+  FnChild(FnChild &&other)
+      : forked_(std::exchange(other.forked_, {-1, -1})),
+        slot_(std::exchange(other.slot_, nullptr)) {}
+  FnChild &operator=(FnChild &&other) {
+    if (this != &other) {
+      release();
+      forked_ = std::exchange(other.forked_, {-1, -1});
+      slot_ = std::exchange(other.slot_, nullptr);
+    }
+    return *this;
+  }
+  ~FnChild() { release(); }
+
+  int id() const { return forked_.pid; }
+
+  R get() {
+    if (forked_.pid < 0)
+      throw std::runtime_error("spawn_fn result already taken");
+    std::string report = detail::read_report(std::exchange(forked_.report, -1));
+    std::optional<int> code = detail::reap_fn(std::exchange(forked_.pid, -1), false);
+    if (not report.empty() && report[0] == 'E')
+      fail("threw: " + report.substr(1));
+    if (not code)
+      fail("was killed by a signal");
+    if (*code != 0)
+      fail("exited with code " + std::to_string(*code));
+    if constexpr (std::is_void_v<R>) {
+      release();
+    } else if constexpr (shared) {
+      R result = *std::launder(reinterpret_cast<Stored *>(slot_->value));
+      release();
+      return result;
+    } else {
+      if (report.empty() || report[0] != 'R')
+        fail("sent no result");
+      R result;
+      size_t count = (report.size() - 1) / sizeof(typename R::value_type);
+      result.resize(count);
+      std::memcpy(result.data(), report.data() + 1,
+                  count * sizeof(typename R::value_type));
+      release();
+      return result;
+    }
+  }
+
+private:
+  [[noreturn]] void fail(const std::string &what) {
+    release();
+    throw std::runtime_error("spawn_fn child " + what);
+  }
+  void release() {
+    if (forked_.pid >= 0)
+      detail::reap_fn(std::exchange(forked_.pid, -1), true);
+    if (forked_.report >= 0)
+      detail::close_fd(std::exchange(forked_.report, -1));
+    if (slot_)
+      detail::unmap_shared(std::exchange(slot_, nullptr), sizeof(Slot));
+  }
+
+  detail::ForkedFn forked_{-1, -1};
+  Slot *slot_ = nullptr;
+};
+
+// Run fn(args...) in a forked child of this process, optionally pinned to
+// some cpus. The child shares nothing with us after the fork: arguments are
+// what it sees at the fork, and only the result comes back. Fork with care
+// from a multithreaded program: only the calling thread exists in the child.
+template <class F, class... Args>
+  requires std::invocable<F, Args...> &&
+           detail::FnResult<std::invoke_result_t<F, Args...>>
+auto spawn_fn(const FnOptions &options, F &&fn, Args &&...args) {
+  using R = std::invoke_result_t<F, Args...>;
+  return FnChild<R>(options, [&]() -> R { return std::invoke(fn, args...); });
+}
+template <class F, class... Args>
+  requires std::invocable<F, Args...> &&
+           detail::FnResult<std::invoke_result_t<F, Args...>>
+auto spawn_fn(F &&fn, Args &&...args) {
+  return spawn_fn(FnOptions{}, std::forward<F>(fn), std::forward<Args>(args)...);
+}
+
+// fn over every element of range, each call in its own forked child with
+// at most workers (0: one per cpu) running at once; results in input order
+template <std::ranges::input_range Range, class F>
+auto parallel_map(Range &&range, F &&fn, size_t workers = 0) {
+  using R = std::invoke_result_t<F, std::ranges::range_reference_t<Range>>;
+  static_assert(not std::is_void_v<R>, "parallel_map needs a result");
+  if (workers == 0)
+    workers = detail::cpu_count();
+  std::vector<R> results;
+  std::vector<FnChild<R>> running; // oldest first
+  size_t oldest = 0;
+  for (auto &&item : range) {
+    if (running.size() - oldest == workers)
+      results.push_back(running[oldest++].get());
+    running.push_back(spawn_fn(fn, item));
+  }
+  while (oldest < running.size())
+    results.push_back(running[oldest++].get());
+  return results;
+}
+#endif
 } // namespace process
@@ -0,0 +1,309 @@
+#pragma once
+
+// Single-producer single-consumer byte ring in a memfd, shared between a
+// parent and the child it was handed to through Stdio::shm_channel(). The
+// parent attaches to the child's native_handle(), the child to the stdio fd
+// it received; both sides use the same Writer and Reader below, so this
+// header has no dependency on the rest of the library.
+//
+// Waiting is done on futexes in the shared mapping. A side only issues a
+// wake when the other has announced it is sleeping, so a busy stream costs
+// no system calls. Sleeps are bounded so that a peer which died without
+// closing its end is noticed: the child side watches the process that
+// created the ring (through a pidfd, since wrappers such as sh -c may sit
+// in between), the parent side the child recorded at spawn.
+
+#ifndef _WIN32
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <linux/futex.h>
+#include <poll.h>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+
+namespace process::shm {
+
+struct RingHeader {
+  static constexpr uint32_t magic_value = 0x50524e47; // "PRNG"
+  uint32_t magic;
+  uint32_t capacity; // a power of two
+  int32_t parent_pid;
+  int32_t child_pid; // filled in by the parent once the child is spawned
+
+  // producer side
+  alignas(64) std::atomic<uint64_t> head; // bytes ever written
+  std::atomic<uint32_t> data_seq;         // futex: bumped on new data
+  std::atomic<uint32_t> reader_waiting;
+  std::atomic<uint32_t> writer_closed;
+
+  // consumer side
+  alignas(64) std::atomic<uint64_t> tail; // bytes ever consumed
+  std::atomic<uint32_t> space_seq;        // futex: bumped on freed space
+  std::atomic<uint32_t> writer_waiting;
+  std::atomic<uint32_t> reader_closed;
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+// offset of the data area; page aligned so it starts on its own cache lines
+inline size_t data_offset() { return static_cast<size_t>(sysconf(_SC_PAGESIZE)); }
+
+// Create a memfd holding an empty ring of at least capacity bytes.
+inline int create_ring(size_t capacity) {
+  size_t size = 4096;
+  while (size < capacity)
+    size *= 2;
+  if (size > UINT32_MAX / 2 + 1)
+    throw std::runtime_error("shm channel capacity too large");
+  int fd = ::memfd_create("process-shm-channel", MFD_CLOEXEC);
+  if (fd == -1)
+    throw std::runtime_error(std::string("failed to create shm channel: ") +
+                             strerror(errno));
+  RingHeader header{};
+  header.magic = RingHeader::magic_value;
+  header.capacity = static_cast<uint32_t>(size);
+  header.parent_pid = ::getpid();
+  if (::ftruncate(fd, data_offset() + size) == -1 ||
+      ::pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+    int err = errno;
+    ::close(fd);
+    throw std::runtime_error(std::string("failed to size shm channel: ") +
+                             strerror(err));
+  }
+  return fd;
+}
+
+// Record the child at the far end so the parent side can notice its death.
+inline void set_child(int fd, pid_t pid) {
+  int32_t value = pid;
+  if (::pwrite(fd, &value, sizeof(value), offsetof(RingHeader, child_pid)) !=
+      sizeof(value))
+    throw std::runtime_error("failed to record shm channel peer");
+}
+
+class Ring {
+public:
+  explicit Ring(int fd) {
+    size_t offset = data_offset();
+    RingHeader probe;
+    if (::pread(fd, &probe, sizeof(probe), 0) != sizeof(probe) ||
+        probe.magic != RingHeader::magic_value)
+      throw std::runtime_error("fd is not a shm channel");
+    size_ = offset + probe.capacity;
+    void *map = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+      throw std::runtime_error(std::string("failed to map shm channel: ") +
+                               strerror(errno));
+    header_ = static_cast<RingHeader *>(map);
+    data_ = static_cast<std::byte *>(map) + offset;
+    mask_ = probe.capacity - 1;
+    parent_side_ = probe.parent_pid == ::getpid();
+    if (not parent_side_) {
+      parent_pid_ = probe.parent_pid;
+      parent_fd_ = static_cast<int>(::syscall(SYS_pidfd_open, parent_pid_, 0));
+      parent_gone_ = parent_fd_ == -1 && errno == ESRCH;
+    }
+  }
+  ~Ring() {
+    if (header_)
+      ::munmap(header_, size_);
+    if (parent_fd_ >= 0)
+      ::close(parent_fd_);
+  }
+  Ring(Ring &&other) { take(other); }
+  Ring &operator=(Ring &&other) {
+    if (this != &other) {
+      if (header_)
+        ::munmap(header_, size_);
+      if (parent_fd_ >= 0)
+        ::close(parent_fd_);
+      take(other);
+    }
+    return *this;
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+protected:
+  void take(Ring &other) {
+    header_ = std::exchange(other.header_, nullptr);
+    data_ = other.data_;
+    size_ = other.size_;
+    mask_ = other.mask_;
+    parent_side_ = other.parent_side_;
+    parent_pid_ = other.parent_pid_;
+    parent_fd_ = std::exchange(other.parent_fd_, -1);
+    parent_gone_ = other.parent_gone_;
+  }
+  // Sleep while seq is unchanged, announcing it through waiting. ready is
+  // rechecked after the announcement so a wake cannot be missed. Returns
+  // false when the sleep timed out, the cue to check on the peer.
+  template <class Ready>
+  bool sleep_on(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiting,
+                Ready ready) {
+    uint32_t seen = seq.load();
+    waiting.store(1);
+    bool woken = true;
+    if (not ready()) {
+      timespec timeout{0, 100 * 1000 * 1000};
+      woken = ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq),
+                        FUTEX_WAIT, seen, &timeout, nullptr, 0) == 0 ||
+              errno != ETIMEDOUT;
+    }
+    waiting.store(0);
+    return woken;
+  }
+  static void wake(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiting) {
+    if (waiting.load()) {
+      seq.fetch_add(1);
+      ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAKE, 1,
+                nullptr, nullptr, 0);
+    }
+  }
+  // the other process has gone away without closing its end
+  bool peer_gone() {
+    if (not parent_side_) {
+      if (not parent_gone_ && parent_fd_ >= 0) {
+        pollfd exited{parent_fd_, POLLIN, 0};
+        parent_gone_ = ::poll(&exited, 1, 0) == 1;
+      } else if (not parent_gone_) { // no pidfds: the pid may be reused
+        parent_gone_ = ::kill(parent_pid_, 0) == -1 && errno == ESRCH;
+      }
+      return parent_gone_;
+    }
+    pid_t child = header_->child_pid;
+    if (child <= 0)
+      return false;
+    siginfo_t info{};
+    // WNOWAIT leaves a dead child for its owner to reap
+    if (::waitid(P_PID, child, &info, WEXITED | WNOHANG | WNOWAIT) == -1)
+      return errno == ECHILD; // already reaped
+    return info.si_pid == child;
+  }
+
+  RingHeader *header_ = nullptr;
+  std::byte *data_ = nullptr;
+  size_t size_ = 0;
+  size_t mask_ = 0;
+  bool parent_side_ = false;
+  pid_t parent_pid_ = 0;  // child side: the ring's creator
+  int parent_fd_ = -1;    // and a pidfd on it
+  bool parent_gone_ = false;
+};
+
+class Writer : public Ring {
+public:
+  using Ring::Ring;
+  Writer(Writer &&) = default;
+  Writer &operator=(Writer &&other) {
+    if (this != &other)
+      close();
+    Ring::operator=(std::move(other));
+    return *this;
+  }
+  ~Writer() { close(); }
+
+  // Block until every byte is in the ring. Returns fewer bytes only when
+  // the reader has closed its end or died.
+  size_t write(std::span<const std::byte> buffer) {
+    size_t done = 0;
+    while (done < buffer.size() && not header_->reader_closed.load()) {
+      uint64_t head = header_->head.load(std::memory_order_relaxed);
+      size_t room = capacity() - (head - header_->tail.load());
+      if (room == 0) {
+        uint64_t full_tail = head - capacity();
+        bool woken = sleep_on(header_->space_seq, header_->writer_waiting, [&] {
+          return header_->tail.load() != full_tail ||
+                 header_->reader_closed.load();
+        });
+        if (not woken && peer_gone())
+          break;
+        continue;
+      }
+      size_t step = std::min(room, buffer.size() - done);
+      size_t at = head & mask_;
+      size_t first = std::min(step, capacity() - at);
+      memcpy(data_ + at, buffer.data() + done, first);
+      memcpy(data_, buffer.data() + done + first, step - first);
+      header_->head.store(head + step);
+      wake(header_->data_seq, header_->reader_waiting);
+      done += step;
+    }
+    return done;
+  }
+  // signal end of stream; the reader drains what is left, then sees 0
+  void close() {
+    if (header_ && not header_->writer_closed.exchange(1)) {
+      header_->data_seq.fetch_add(1);
+      ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header_->data_seq),
+                FUTEX_WAKE, 1, nullptr, nullptr, 0);
+    }
+  }
+};
+
+class Reader : public Ring {
+public:
+  using Ring::Ring;
+  Reader(Reader &&) = default;
+  Reader &operator=(Reader &&other) {
+    if (this != &other)
+      close();
+    Ring::operator=(std::move(other));
+    return *this;
+  }
+  ~Reader() { close(); }
+
+  // Block until some bytes are available and copy up to buffer.size() of
+  // them out. Returns 0 once the writer has closed (or died) and the ring
+  // is drained.
+  size_t read(std::span<std::byte> buffer) {
+    if (buffer.empty())
+      return 0;
+    while (true) {
+      uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+      size_t ready = header_->head.load() - tail;
+      if (ready == 0) {
+        if (header_->writer_closed.load()) {
+          if (header_->head.load() == tail)
+            return 0;
+          continue;
+        }
+        bool woken = sleep_on(header_->data_seq, header_->reader_waiting, [&] {
+          return header_->head.load() != tail || header_->writer_closed.load();
+        });
+        if (not woken && peer_gone())
+          return 0;
+        continue;
+      }
+      size_t step = std::min(ready, buffer.size());
+      size_t at = tail & mask_;
+      size_t first = std::min(step, capacity() - at);
+      memcpy(buffer.data(), data_ + at, first);
+      memcpy(buffer.data() + first, data_, step - first);
+      header_->tail.store(tail + step);
+      wake(header_->space_seq, header_->writer_waiting);
+      return step;
+    }
+  }
+  void close() {
+    if (header_ && not header_->reader_closed.exchange(1)) {
+      header_->space_seq.fetch_add(1);
+      ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header_->space_seq),
+                FUTEX_WAKE, 1, nullptr, nullptr, 0);
+    }
+  }
+};
+
+} // namespace process::shm
+#endif
@@ -1,13 +1,58 @@
 #ifndef _WIN32
 #include "process.hpp"
+#include "shm_channel.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
 #include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
 #include <fcntl.h>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <optional>
+#include <poll.h>
+#include <queue>
+#include <regex>
+#include <sched.h>
+#include <mutex>
 #include <span>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/random.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <thread>
+#include <tuple>
 #include <unistd.h>
+#include <unordered_map>
+#include <utility>
+
+#ifndef MPOL_DEFAULT
+#define MPOL_DEFAULT 0
+#define MPOL_PREFERRED 1
+#define MPOL_BIND 2
+#define MPOL_INTERLEAVE 3
+#endif
+#ifndef IOPRIO_WHO_PROCESS
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#endif
 
 extern char **environ;
 
@@ -20,20 +65,338 @@ using std::vector;
 namespace FileDesc {
 size_t read(int fd, span<std::byte> buffer) {
   ssize_t bytes_read;
-  if ((bytes_read = ::read(fd, buffer.data(), buffer.size())) > 0) {
-    return bytes_read;
+  while ((bytes_read = ::read(fd, buffer.data(), buffer.size())) == -1) {
+    if (errno == EAGAIN)
+      throw std::runtime_error("read would block, use try_read");
+    if (errno != EINTR)
+      throw std::runtime_error(string("failed to read from fd: ") +
+                               strerror(errno));
+  }
+  return static_cast<size_t>(bytes_read);
+}
+
+process::IoResult try_read(int fd, span<std::byte> buffer) {
+  ssize_t bytes_read;
+  while ((bytes_read = ::read(fd, buffer.data(), buffer.size())) == -1 &&
+         errno == EINTR) {
+  }
+  if (bytes_read > 0 || (bytes_read == 0 && buffer.empty()))
+    return static_cast<size_t>(bytes_read);
+  if (bytes_read == 0)
+    return process::IoError::Eof;
+  if (errno == EAGAIN)
+    return process::IoError::WouldBlock;
+  return {process::IoError::Error, errno};
+}
+
+void set_nonblocking(int fd, bool enable) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1 ||
+      fcntl(fd, F_SETFL, enable ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) ==
+          -1)
+    throw std::runtime_error("failed to change blocking mode");
+}
+
+// Run a write-like call so that a closed pipe is reported as EPIPE without
+// delivering SIGPIPE: the signal is blocked for this thread around the call
+// and, if the write raised it, consumed before the mask is restored.
+template <class Write> ssize_t without_sigpipe(Write write) {
+  sigset_t pipe_set, old_set;
+  sigemptyset(&pipe_set);
+  sigaddset(&pipe_set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+  ssize_t written;
+  do {
+    written = write();
+  } while (written == -1 && errno == EINTR);
+  int err = errno;
+  if (written == -1 && err == EPIPE && not sigismember(&old_set, SIGPIPE)) {
+    timespec zero{};
+    sigtimedwait(&pipe_set, nullptr, &zero);
   }
-  return 0;
+  pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+  errno = err;
+  return written;
+}
+
+ssize_t writev_nosigpipe(int fd, const iovec *iov, int count) {
+  return without_sigpipe([&] { return ::writev(fd, iov, count); });
+}
+
+[[noreturn]] void throw_write_error() {
+  if (errno == EPIPE)
+    throw process::BrokenPipe("child closed its end of the pipe");
+  throw std::runtime_error(string("failed to write file to fd: ") +
+                           strerror(errno));
 }
 
 size_t write(int fd, span<const std::byte> buffer) {
+  iovec iov{.iov_base = const_cast<std::byte *>(buffer.data()),
+            .iov_len = buffer.size()};
   ssize_t written;
-  if ((written = ::write(fd, buffer.data(), buffer.size())) < 0) {
-    throw std::runtime_error("failed to write file to fd");
+  if ((written = writev_nosigpipe(fd, &iov, 1)) < 0) {
+    throw_write_error();
   }
   return static_cast<size_t>(written);
 }
 
+// Hand whole pages of buffer to the pipe by reference with vmsplice; the
+// unaligned head and tail, and everything when fd is not a pipe, go through
+// write. Blocks until every byte is in the pipe.
+size_t write_zero_copy(int fd, span<const std::byte> buffer) {
+  auto page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  auto start = reinterpret_cast<uintptr_t>(buffer.data());
+  size_t head = std::min(buffer.size(), size_t((page - start % page) % page));
+  size_t body = (buffer.size() - head) / page * page;
+  auto write_all = [fd](span<const std::byte> part) {
+    while (not part.empty())
+      part = part.subspan(write(fd, part));
+  };
+  write_all(buffer.first(head));
+  span<const std::byte> rest = buffer.subspan(head, body);
+  while (not rest.empty()) {
+    iovec iov{.iov_base = const_cast<std::byte *>(rest.data()),
+              .iov_len = rest.size()};
+    ssize_t moved = without_sigpipe([&] { return ::vmsplice(fd, &iov, 1, 0); });
+    if (moved >= 0) {
+      rest = rest.subspan(moved);
+    } else if (errno == EAGAIN) {
+      pollfd ready{.fd = fd, .events = POLLOUT, .revents = 0};
+      ::poll(&ready, 1, -1);
+    } else if (errno == EBADF || errno == EINVAL) {
+      break; // not a pipe
+    } else {
+      throw_write_error();
+    }
+  }
+  write_all(rest);
+  write_all(buffer.subspan(head + body));
+  return buffer.size();
+}
+
+// Move up to limit bytes from the pipe from into to with splice, falling
+// back to read and write once to turns out not to accept it.
+process::PumpStats pump(int from, int to, size_t limit) {
+  auto start = std::chrono::steady_clock::now();
+  process::PumpStats stats;
+  bool splicing = true;
+  std::byte chunk[64 * 1024];
+  while (stats.bytes < limit) {
+    size_t want = std::min<size_t>(limit - stats.bytes, 1 << 20);
+    if (splicing) {
+      ssize_t moved = without_sigpipe(
+          [&] { return ::splice(from, nullptr, to, nullptr, want, SPLICE_F_MOVE); });
+      stats.calls += 1;
+      if (moved > 0) {
+        stats.bytes += moved;
+        continue;
+      }
+      if (moved == 0)
+        break;
+      if (errno == EAGAIN)
+        throw std::runtime_error("pump would block, handles must be blocking");
+      if (errno != EINVAL)
+        throw_write_error();
+      splicing = false;
+      continue;
+    }
+    size_t got = read(from, span{chunk, std::min(want, sizeof(chunk))});
+    stats.calls += 1;
+    if (got == 0)
+      break;
+    for (span<const std::byte> rest{chunk, got}; not rest.empty();) {
+      rest = rest.subspan(write(to, rest));
+      stats.calls += 1;
+    }
+    stats.bytes += got;
+    stats.copied += got;
+  }
+  stats.elapsed = std::chrono::steady_clock::now() - start;
+  return stats;
+}
+
+// Move up to limit bytes of the regular file from, starting at offset, into
+// to with sendfile, which takes them straight from the page cache; falls
+// back to pread and write once to turns out not to accept it (e.g. a file
+// opened with O_APPEND). offset ends past the bytes moved.
+process::PumpStats send_file(int from, off_t &offset, int to, size_t limit) {
+  auto start = std::chrono::steady_clock::now();
+  process::PumpStats stats;
+  bool sending = true;
+  std::byte chunk[64 * 1024];
+  while (stats.bytes < limit) {
+    size_t want = std::min<size_t>(limit - stats.bytes, 1 << 20);
+    if (sending) {
+      ssize_t moved =
+          without_sigpipe([&] { return ::sendfile(to, from, &offset, want); });
+      stats.calls += 1;
+      if (moved > 0) {
+        stats.bytes += moved;
+        continue;
+      }
+      if (moved == 0)
+        break;
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN)
+        throw std::runtime_error("pump would block, handles must be blocking");
+      if (errno != EINVAL)
+        throw_write_error();
+      sending = false;
+      continue;
+    }
+    ssize_t got;
+    while ((got = ::pread(from, chunk, std::min(want, sizeof(chunk)), offset)) ==
+               -1 &&
+           errno == EINTR) {
+    }
+    stats.calls += 1;
+    if (got == -1)
+      throw std::runtime_error(string("failed to read file: ") + strerror(errno));
+    if (got == 0)
+      break;
+    for (span<const std::byte> rest{chunk, static_cast<size_t>(got)};
+         not rest.empty();) {
+      rest = rest.subspan(write(to, rest));
+      stats.calls += 1;
+    }
+    offset += got;
+    stats.bytes += got;
+    stats.copied += got;
+  }
+  stats.elapsed = std::chrono::steady_clock::now() - start;
+  return stats;
+}
+
+// Body of a Stdio::tee relay; owns the three fds. Everything arriving on
+// the pipe source is duplicated into the pipe capture with tee, then moved
+// on to target with splice (or read and write when target refuses splice).
+// Once one side is gone the other is served alone. A target that is
+// non-blocking is waited for, not dropped.
+void tee_relay(int source, int capture, int target) {
+  bool capturing = true, forwarding = true, splicing = true;
+  std::byte chunk[64 * 1024];
+  // whether a failed transfer to target may be retried; if not, forwarding
+  // stops for good
+  auto retry_target = [&] {
+    if (errno == EINTR)
+      return true;
+    pollfd ready{.fd = target, .events = POLLOUT, .revents = 0};
+    if (errno == EAGAIN && ::poll(&ready, 1, -1) >= 0)
+      return true;
+    forwarding = false;
+    return false;
+  };
+  // move up to count queued bytes to target (dropping them once it has
+  // failed); all of them when exact, else one step. 0 at end of stream,
+  // short of count only when source cannot be read.
+  auto forward = [&](size_t count, bool exact) -> size_t {
+    size_t done = 0;
+    while (done < count) {
+      ssize_t moved;
+      if (forwarding && splicing) {
+        moved = without_sigpipe([&] {
+          return ::splice(source, nullptr, target, nullptr, count - done,
+                          SPLICE_F_MOVE);
+        });
+        if (moved == -1) {
+          if (errno == EINVAL)
+            splicing = false; // fall back to copying
+          else
+            retry_target();
+          continue;
+        }
+      } else {
+        size_t step = std::min(count - done, sizeof(chunk));
+        while ((moved = ::read(source, chunk, step)) == -1 && errno == EINTR) {
+        }
+        if (moved == -1)
+          return done;
+        iovec iov{chunk, static_cast<size_t>(moved)};
+        while (forwarding && iov.iov_len > 0) {
+          ssize_t written = writev_nosigpipe(target, &iov, 1);
+          if (written >= 0)
+            iov = {static_cast<std::byte *>(iov.iov_base) + written,
+                   iov.iov_len - written};
+          else
+            retry_target();
+        }
+      }
+      if (moved == 0)
+        return done;
+      done += moved;
+      if (not exact)
+        break;
+    }
+    return done;
+  };
+  while (capturing || forwarding) {
+    if (not capturing) {
+      if (forward(1 << 20, false) == 0)
+        break;
+      continue;
+    }
+    ssize_t copied = without_sigpipe([&] {
+      return forwarding
+                 ? ::tee(source, capture, 1 << 20, 0)
+                 : ::splice(source, nullptr, capture, nullptr, 1 << 20,
+                            SPLICE_F_MOVE);
+    });
+    if (copied == 0)
+      break;
+    if (copied < 0) {
+      if (errno != EPIPE)
+        break;
+      capturing = false; // our handle was dropped
+      continue;
+    }
+    // bytes already teed that stay in source would be captured twice, so
+    // the relay ends if they cannot be consumed
+    if (forwarding && forward(copied, true) < static_cast<size_t>(copied))
+      break;
+  }
+  // target first: once the capture reader sees the end, target is complete
+  for (int fd : {source, target, capture})
+    ::close(fd);
+}
+
+process::IoResult try_write(int fd, span<const std::byte> buffer) {
+  iovec iov{.iov_base = const_cast<std::byte *>(buffer.data()),
+            .iov_len = buffer.size()};
+  ssize_t written = writev_nosigpipe(fd, &iov, 1);
+  if (written >= 0)
+    return static_cast<size_t>(written);
+  if (errno == EAGAIN)
+    return process::IoError::WouldBlock;
+  if (errno == EPIPE)
+    return process::IoError::Eof;
+  return {process::IoError::Error, errno};
+}
+
+// write every byte of every buffer, resuming after short writes
+void writev_all(int fd, span<iovec> iovs) {
+  size_t first = 0;
+  while (first < iovs.size()) {
+    if (iovs[first].iov_len == 0) {
+      first += 1;
+      continue;
+    }
+    int count = static_cast<int>(std::min<size_t>(iovs.size() - first, IOV_MAX));
+    ssize_t written = writev_nosigpipe(fd, &iovs[first], count);
+    if (written < 0)
+      throw_write_error();
+    size_t left = static_cast<size_t>(written);
+    while (left > 0) {
+      size_t step = std::min(left, iovs[first].iov_len);
+      iovs[first].iov_base = static_cast<char *>(iovs[first].iov_base) + step;
+      iovs[first].iov_len -= step;
+      left -= step;
+      if (iovs[first].iov_len == 0)
+        first += 1;
+    }
+  }
+}
+
 size_t read_to_end(int fd, vector<std::byte> &buffer) {
   size_t buf_init_len = size(buffer);
   vector<std::byte> tmp(2048);
@@ -54,6 +417,17 @@ size_t read_to_string(int fd, string &buffer) {
   return size(buffer) - buf_init_len;
 }
 
+// hand every chunk up to end of stream to sink
+size_t read_each(int fd, const process::detail::SinkRef &sink) {
+  std::byte chunk[64 * 1024];
+  size_t total = 0;
+  while (size_t got = read(fd, chunk)) {
+    sink(span{chunk, got});
+    total += got;
+  }
+  return total;
+}
+
 void read2(int h1, vector<std::byte> &buf1, int h2, vector<std::byte> &buf2) {
   vector<std::byte> tmp1(2048), tmp2(2048);
   size_t size1 = 0, size2 = 0;
@@ -68,38 +442,170 @@ void read2(int h1, vector<std::byte> &buf1, int h2, vector<std::byte> &buf2) {
   }
 }
 
-void read2_to_string(int h1, string &buf1, int h2, string &buf2) {
-  string tmp1(2048, '\0'), tmp2(2048, '\0');
-  size_t size1 = 0, size2 = 0;
-  while ((size1 = read(h1, std::as_writable_bytes(span{tmp1}))) > 0 ||
-         (size2 = read(h2, std::as_writable_bytes(span{tmp2}))) > 0) {
-    if (size1 > 0) {
-      buf1.insert(end(buf1), begin(tmp1), begin(tmp1) + size1);
+// One captured stream: bytes collect in text until it would pass limit,
+// then text is moved into an unlinked temporary file in dir and everything
+// after it is appended there. The caller takes ownership of spill. With a
+// sink set, bytes go straight to it instead.
+struct Capture {
+  string *text = nullptr;
+  size_t limit = SIZE_MAX;
+  string dir = "";
+  int spill = -1;
+  optional<process::detail::SinkRef> sink = std::nullopt;
+
+  ~Capture() {
+    if (spill >= 0)
+      close(spill);
+  }
+  int take_spill() { return std::exchange(spill, -1); }
+
+  void append(const char *data, size_t len) {
+    if (sink) {
+      (*sink)(std::as_bytes(span{data, len}));
+      return;
     }
-    if (size2 > 0) {
-      buf2.insert(end(buf2), begin(tmp2), begin(tmp2) + size2);
+    if (spill < 0 && text->size() + len <= limit) {
+      text->append(data, len);
+      return;
+    }
+    if (spill < 0) {
+      open_spill();
+      write_spill(text->data(), text->size());
+      string().swap(*text); // give the memory back
+    }
+    write_spill(data, len);
+  }
+
+private:
+  void open_spill() {
+    if (dir.empty()) {
+      const char *tmp = getenv("TMPDIR");
+      dir = tmp && *tmp ? tmp : "/tmp";
+    }
+    spill = ::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (spill == -1 && (errno == EOPNOTSUPP || errno == EISDIR)) {
+      // filesystems without O_TMPFILE: create a named file and unlink it
+      string path = dir + "/process-spill-XXXXXX";
+      spill = ::mkostemp(path.data(), O_CLOEXEC);
+      if (spill >= 0)
+        ::unlink(path.c_str());
+    }
+    if (spill == -1)
+      throw std::runtime_error("failed to create spill file in " + dir + ": " +
+                               strerror(errno));
+  }
+  void write_spill(const char *data, size_t len) {
+    while (len > 0) {
+      ssize_t written = ::write(spill, data, len);
+      if (written == -1 && errno == EINTR)
+        continue;
+      if (written == -1)
+        throw std::runtime_error(string("failed to write spill file: ") +
+                                 strerror(errno));
+      data += written;
+      len -= written;
+    }
+  }
+};
+
+// Feed stdin and drain stdout/stderr from one poll loop, so a child that
+// blocks writing output while we block writing its input cannot deadlock.
+// next_input returns the next chunk to send, empty once the input is
+// exhausted; in_fd is then closed. Any fd may be -1. With until, in_fd is
+// left open and the loop ends as soon as the input is written and until()
+// holds, for exchanges with a child that keeps running.
+void communicate(int in_fd, const std::function<span<const std::byte>()> &next_input,
+                 int out_fd, Capture &out, int err_fd, Capture &err,
+                 const std::function<bool()> &until = nullptr) {
+  constexpr size_t chunk = 64 * 1024;
+  span<const std::byte> pending;
+  if (in_fd >= 0)
+    fcntl(in_fd, F_SETFL, fcntl(in_fd, F_GETFL) | O_NONBLOCK);
+  // with until, in_fd stays open for the caller once the input is written
+  auto close_input = [&] {
+    if (not until)
+      close(in_fd);
+    in_fd = -1;
+  };
+  // reads land in a cache-hot scratch buffer on the stack and are appended,
+  // letting the strings grow geometrically instead of zero-filling ahead of
+  // each read
+  char scratch[chunk];
+  auto drain = [&](int &fd, Capture &capture) {
+    ssize_t got = ::read(fd, scratch, sizeof(scratch));
+    if (got > 0) {
+      capture.append(scratch, got);
+    } else if (got == 0 || (errno != EINTR && errno != EAGAIN)) {
+      fd = -1; // end of stream, the handle owner closes it
     }
+  };
+  while (in_fd >= 0 || out_fd >= 0 || err_fd >= 0) {
+    if (until && in_fd < 0 && until())
+      return;
+    if (in_fd >= 0 && pending.empty()) {
+      pending = next_input ? next_input() : span<const std::byte>{};
+      if (pending.empty()) {
+        close_input();
+        continue;
+      }
+    }
+    pollfd fds[3] = {{in_fd, POLLOUT, 0}, {out_fd, POLLIN, 0}, {err_fd, POLLIN, 0}};
+    if (poll(fds, 3, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error("failed to poll child pipes");
+    }
+    if (in_fd >= 0 && fds[0].revents) {
+      iovec iov{const_cast<std::byte *>(pending.data()), pending.size()};
+      ssize_t written = writev_nosigpipe(in_fd, &iov, 1);
+      if (written >= 0) {
+        pending = pending.subspan(written);
+      } else if (errno == EPIPE) {
+        close_input(); // the child stopped reading, its output still counts
+      } else if (errno != EAGAIN) {
+        close_input();
+        throw_write_error();
+      }
+    }
+    if (out_fd >= 0 && fds[1].revents)
+      drain(out_fd, out);
+    if (err_fd >= 0 && fds[2].revents)
+      drain(err_fd, err);
   }
 }
+
+void read2_to_string(int h1, string &buf1, int h2, string &buf2) {
+  Capture out{&buf1}, err{&buf2};
+  communicate(-1, nullptr, h1, out, h2, err);
+}
 } // namespace FileDesc
 
 namespace process {
 
+// exit code of a normally terminated child, none when killed by a signal
+static optional<int> exit_code_of(int wstatus) {
+  if (WIFEXITED(wstatus))
+    return WEXITSTATUS(wstatus);
+  return std::nullopt;
+}
+
+static int pidfd_open(pid_t pid) {
+  return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+}
+
 struct Process {
   pid_t pid;
-  int wait() {
+  optional<int> wait() {
     int wstatus;
-    int exit_code;
-    if (waitpid(pid, &wstatus, 0) == -1) {
-      throw std::runtime_error("Failed to wait for child process");
-    }
-    if (WIFEXITED(wstatus)) {
-      exit_code = WEXITSTATUS(wstatus);
+    while (waitpid(pid, &wstatus, 0) == -1) {
+      if (errno != EINTR)
+        throw std::runtime_error("Failed to wait for child process");
     }
-    return exit_code;
+    return exit_code_of(wstatus);
   }
+  // an exited child that is not reaped yet is no error
   void kill() {
-    if (::kill(pid, SIGKILL) != 0) {
+    if (::kill(pid, SIGKILL) != 0 && errno != ESRCH) {
       throw std::runtime_error(string("failed to kill process") +
                                std::to_string(pid));
     }
@@ -111,9 +617,9 @@ struct ExitStatus::Impl {
   Impl() : code(std::nullopt) {}
   Impl(int result) : code(result) {}
 };
-ExitStatus::ExitStatus() : impl_(std::make_unique<Impl>()) {}
+ExitStatus::ExitStatus() {}
 ExitStatus::~ExitStatus() = default;
-ExitStatus::ExitStatus(ExitStatus &&other) { *this = std::move(other); }
+ExitStatus::ExitStatus(ExitStatus &&other) : impl_(std::move(other.impl_)) {}
 ExitStatus &ExitStatus::operator=(ExitStatus &&other) {
   if (this != &other) {
     this->impl_ = std::move(other.impl_);
@@ -124,13 +630,33 @@ bool ExitStatus::success() { return impl_->code == 0; }
 optional<int> ExitStatus::code() { return impl_->code; }
 
 /*============================================================================*/
-struct ChildStdin::Impl {
+// file descriptor closed when its owner goes away; moved-from owners hold -1
+struct OwnedFd {
   int fd;
-  Impl(int fd) : fd(fd) {}
+  OwnedFd(int fd = -1) : fd(fd) {}
+  OwnedFd(OwnedFd &&other) : fd(std::exchange(other.fd, -1)) {}
+  OwnedFd &operator=(OwnedFd &&other) {
+    if (this != &other) {
+      reset();
+      fd = std::exchange(other.fd, -1);
+    }
+    return *this;
+  }
+  ~OwnedFd() { reset(); }
+  void reset() {
+    if (fd >= 0)
+      close(fd);
+    fd = -1;
+  }
+  int release() { return std::exchange(fd, -1); }
+};
+
+struct ChildStdin::Impl : OwnedFd {
+  using OwnedFd::OwnedFd;
 };
-ChildStdin::ChildStdin() : impl_(nullptr) {}
+ChildStdin::ChildStdin() {}
 ChildStdin::~ChildStdin() {}
-ChildStdin::ChildStdin(ChildStdin &&other) { *this = std::move(other); }
+ChildStdin::ChildStdin(ChildStdin &&other) : impl_(std::move(other.impl_)) {}
 ChildStdin &ChildStdin::operator=(ChildStdin &&other) {
   if (this != &other) {
     this->impl_ = std::move(other.impl_);
@@ -140,65 +666,246 @@ ChildStdin &ChildStdin::operator=(ChildStdin &&other) {
 size_t ChildStdin::write(span<const std::byte> buffer) {
   return FileDesc::write(impl_->fd, buffer);
 }
+native_handle_type ChildStdin::native_handle() const { return impl_->fd; }
+void ChildStdin::set_nonblocking(bool enable) {
+  FileDesc::set_nonblocking(impl_->fd, enable);
+}
+IoResult ChildStdin::try_write(span<const std::byte> buffer) {
+  return FileDesc::try_write(impl_->fd, buffer);
+}
+size_t ChildStdin::write_zero_copy(span<const std::byte> buffer) {
+  return FileDesc::write_zero_copy(impl_->fd, buffer);
+}
 
-struct ChildStdout::Impl {
-  int fd;
-  Impl(int fd) : fd(fd) {}
+// our end of a pipe the child writes; bytes Child::wait_for_output read
+// ahead wait in pending for the handle's own reads
+struct ReadEnd : OwnedFd {
+  using OwnedFd::OwnedFd;
+  string pending;
+  size_t scanned = 0; // of pending, already searched by wait_for_output
+
+  size_t take(span<std::byte> buffer) {
+    size_t step = std::min(buffer.size(), pending.size());
+    memcpy(buffer.data(), pending.data(), step);
+    pending.erase(0, step);
+    scanned -= std::min(scanned, step);
+    return step;
+  }
+  string take_all() {
+    scanned = 0;
+    return std::exchange(pending, string());
+  }
+  size_t read(span<std::byte> buffer) {
+    return pending.empty() ? FileDesc::read(fd, buffer) : take(buffer);
+  }
+  IoResult try_read(span<std::byte> buffer) {
+    if (pending.empty() || buffer.empty())
+      return FileDesc::try_read(fd, buffer);
+    return take(buffer);
+  }
+  size_t read_to_end(vector<std::byte> &buffer) {
+    string ahead = take_all();
+    auto bytes = std::as_bytes(span{ahead});
+    buffer.insert(buffer.end(), bytes.begin(), bytes.end());
+    return ahead.size() + FileDesc::read_to_end(fd, buffer);
+  }
+  size_t read_to_string(string &buffer) {
+    string ahead = take_all();
+    buffer += ahead;
+    return ahead.size() + FileDesc::read_to_string(fd, buffer);
+  }
+  size_t read_each(const detail::SinkRef &sink) {
+    string ahead = take_all();
+    if (not ahead.empty())
+      sink(std::as_bytes(span{ahead}));
+    return ahead.size() + FileDesc::read_each(fd, sink);
+  }
+};
+
+struct ChildStdout::Impl : ReadEnd {
+  using ReadEnd::ReadEnd;
 };
-ChildStdout::ChildStdout() : impl_(nullptr) {}
+ChildStdout::ChildStdout() {}
 ChildStdout::~ChildStdout() {}
-ChildStdout::ChildStdout(ChildStdout &&other) { *this = std::move(other); }
+ChildStdout::ChildStdout(ChildStdout &&other) : impl_(std::move(other.impl_)) {}
 ChildStdout &ChildStdout::operator=(ChildStdout &&other) {
   if (this != &other) {
     this->impl_ = std::move(other.impl_);
   }
   return *this;
 }
-size_t ChildStdout::read(span<std::byte> buffer) {
-  return FileDesc::read(impl_->fd, buffer);
-}
+size_t ChildStdout::read(span<std::byte> buffer) { return impl_->read(buffer); }
 size_t ChildStdout::read_to_end(std::vector<std::byte> &buffer) {
-  return FileDesc::read_to_end(impl_->fd, buffer);
+  return impl_->read_to_end(buffer);
 }
 size_t ChildStdout::read_to_string(std::string &buffer) {
-  return FileDesc::read_to_string(impl_->fd, buffer);
+  return impl_->read_to_string(buffer);
+}
+size_t ChildStdout::read_each(detail::SinkRef sink) {
+  return impl_->read_each(sink);
+}
+native_handle_type ChildStdout::native_handle() const { return impl_->fd; }
+void ChildStdout::set_nonblocking(bool enable) {
+  FileDesc::set_nonblocking(impl_->fd, enable);
 }
+IoResult ChildStdout::try_read(span<std::byte> buffer) {
+  return impl_->try_read(buffer);
+}
+size_t ChildStdout::buffered() const { return impl_->pending.size(); }
 
-struct ChildStderr::Impl {
-  int fd;
-  Impl(int fd) : fd(fd) {}
+struct ChildStderr::Impl : ReadEnd {
+  using ReadEnd::ReadEnd;
 };
-ChildStderr::ChildStderr() : impl_(nullptr) {}
+ChildStderr::ChildStderr() {}
 ChildStderr::~ChildStderr() {}
-ChildStderr::ChildStderr(ChildStderr &&other) { *this = std::move(other); }
+ChildStderr::ChildStderr(ChildStderr &&other) : impl_(std::move(other.impl_)) {}
 ChildStderr &ChildStderr::operator=(ChildStderr &&other) {
   if (this != &other) {
     this->impl_ = std::move(other.impl_);
   }
   return *this;
 }
-size_t ChildStderr::read(span<std::byte> buffer) {
-  return FileDesc::read(impl_->fd, buffer);
-}
+size_t ChildStderr::read(span<std::byte> buffer) { return impl_->read(buffer); }
 size_t ChildStderr::read_to_end(std::vector<std::byte> &buffer) {
-  return FileDesc::read_to_end(impl_->fd, buffer);
+  return impl_->read_to_end(buffer);
 }
 size_t ChildStderr::read_to_string(std::string &buffer) {
-  return FileDesc::read_to_string(impl_->fd, buffer);
+  return impl_->read_to_string(buffer);
+}
+size_t ChildStderr::read_each(detail::SinkRef sink) {
+  return impl_->read_each(sink);
+}
+native_handle_type ChildStderr::native_handle() const { return impl_->fd; }
+void ChildStderr::set_nonblocking(bool enable) {
+  FileDesc::set_nonblocking(impl_->fd, enable);
+}
+IoResult ChildStderr::try_read(span<std::byte> buffer) {
+  return impl_->try_read(buffer);
+}
+size_t ChildStderr::buffered() const { return impl_->pending.size(); }
+
+/*============================================================================*/
+BufferedStdin::BufferedStdin(ChildStdin inner, size_t capacity)
+    : inner_(std::move(inner)), capacity_(std::max<size_t>(capacity, 1)) {
+  buffer_.reserve(capacity_);
+}
+BufferedStdin::~BufferedStdin() {
+  try {
+    flush();
+  } catch (const std::exception &) {
+  }
+}
+BufferedStdin::BufferedStdin(BufferedStdin &&other)
+    : inner_(std::move(other.inner_)), buffer_(std::move(other.buffer_)),
+      capacity_(other.capacity_) {}
+BufferedStdin &BufferedStdin::operator=(BufferedStdin &&other) {
+  if (this != &other) {
+    try {
+      flush();
+    } catch (const std::exception &) {
+    }
+    inner_ = std::move(other.inner_);
+    buffer_ = std::move(other.buffer_);
+    capacity_ = other.capacity_;
+  }
+  return *this;
+}
+size_t BufferedStdin::write(span<const std::byte> buffer) {
+  write_all(buffer);
+  return buffer.size();
+}
+void BufferedStdin::write_all(span<const std::byte> buffer) {
+  span<const std::byte> one[] = {buffer};
+  writev(one);
+}
+void BufferedStdin::writev(span<const span<const std::byte>> buffers) {
+  size_t total = 0;
+  for (auto buffer : buffers)
+    total += buffer.size();
+  if (buffer_.size() + total <= capacity_) {
+    for (auto buffer : buffers)
+      buffer_.insert(end(buffer_), begin(buffer), end(buffer));
+    return;
+  }
+  if (inner_.impl_->fd < 0)
+    throw std::runtime_error("write to closed stdin");
+  // too big to hold: send the pending bytes and the new ones together
+  vector<iovec> iovs;
+  iovs.reserve(buffers.size() + 1);
+  iovs.push_back({buffer_.data(), buffer_.size()});
+  for (auto buffer : buffers)
+    iovs.push_back({const_cast<std::byte *>(buffer.data()), buffer.size()});
+  buffer_.clear();
+  FileDesc::writev_all(inner_.impl_->fd, iovs);
+}
+void BufferedStdin::flush() {
+  if (buffer_.empty())
+    return;
+  if (inner_.impl_->fd < 0)
+    throw std::runtime_error("write to closed stdin");
+  iovec iov{buffer_.data(), buffer_.size()};
+  buffer_.clear();
+  FileDesc::writev_all(inner_.impl_->fd, span{&iov, 1});
+}
+void BufferedStdin::close() {
+  flush();
+  inner_.impl_->reset();
+}
+ChildStdin BufferedStdin::into_inner() {
+  flush();
+  return std::move(inner_);
+}
+
+PumpStats pump(ChildStdout &from, int to_fd, size_t limit) {
+  // bytes read ahead go first, the ordinary way
+  PumpStats ahead;
+  std::byte chunk[64 * 1024];
+  while (from.buffered() && ahead.bytes < limit) {
+    size_t got = from.read(span{chunk, std::min(sizeof(chunk), limit - ahead.bytes)});
+    for (span<const std::byte> rest{chunk, got}; not rest.empty();) {
+      rest = rest.subspan(FileDesc::write(to_fd, rest));
+      ahead.calls += 1;
+    }
+    ahead.bytes += got;
+    ahead.copied += got;
+  }
+  PumpStats stats = FileDesc::pump(from.native_handle(), to_fd, limit - ahead.bytes);
+  stats.bytes += ahead.bytes;
+  stats.copied += ahead.copied;
+  stats.calls += ahead.calls;
+  return stats;
+}
+PumpStats pump(ChildStdout &from, ChildStdin &to, size_t limit) {
+  return pump(from, to.native_handle(), limit);
+}
+// std::async rather than a detached thread: the future joins the pump
+std::future<PumpStats> pump_async(ChildStdout from, int to_fd, size_t limit) {
+  return std::async(std::launch::async,
+                    [from = std::move(from), to_fd, limit]() mutable {
+                      return pump(from, to_fd, limit);
+                    });
+}
+std::future<PumpStats> pump_async(ChildStdout from, ChildStdin to, size_t limit) {
+  return std::async(std::launch::async,
+                    [from = std::move(from), to = std::move(to), limit]() mutable {
+                      return pump(from, to, limit);
+                    });
 }
 
 /*============================================================================*/
 struct Stdio::Impl {
   Value value;
-  Impl(Value v) : value(v), other(std::nullopt) {}
-  optional<int> other;
+  Impl(Value v = Value::Inherit) : value(v), other() {}
+  OwnedFd other; // handed to the child by the next spawn
+  size_t capacity = 0; // of a shm channel
+  int tee_target = -1;  // caller's fd a tee forwards to
   // me, child
   pair<optional<int>, optional<int>>
   to_fds(uint8_t id) { //{0: in, 1: out, 2: err}
     switch (value) {
     case Value::Inherit: {
       if (id == 0)
-        return {STDIN_FILENO, std::nullopt};
+        return {std::nullopt, STDIN_FILENO};
       else if (id == 1)
         return {std::nullopt, STDOUT_FILENO};
       else if (id == 2)
@@ -208,14 +915,14 @@ struct Stdio::Impl {
     }
     case Value::NewPipe: {
       int fds[2];
-      if (::pipe(fds) == -1)
+      if (::pipe2(fds, O_CLOEXEC) == -1)
         throw std::runtime_error("Failed to create pipe");
       return id == 0 ? std::make_pair(fds[1], fds[0])
                      : std::make_pair(fds[0], fds[1]);
     }
     case Value::FromPipe: {
       if (id == 0)
-        return {std::nullopt, other};
+        return {std::nullopt, other.release()};
       else if (id == 1)
         return {std::nullopt, std::nullopt};
       else if (id == 2)
@@ -224,20 +931,53 @@ struct Stdio::Impl {
         throw std::runtime_error("invalid handle id");
     }
     case Value::Null: {
-      int null_fd = open("/dev/null", id == 0 ? O_RDONLY : O_WRONLY);
+      int null_fd =
+          open("/dev/null", (id == 0 ? O_RDONLY : O_WRONLY) | O_CLOEXEC);
       if (null_fd == -1) {
         throw std::runtime_error("failed to open /dev/null");
       }
       return {std::nullopt, null_fd};
     }
+    case Value::ShmChannel: {
+      // a fresh ring per spawn; both ends map the same memfd
+      int ring = process::shm::create_ring(capacity);
+      int theirs = fcntl(ring, F_DUPFD_CLOEXEC, 0);
+      if (theirs == -1) {
+        close(ring);
+        throw std::runtime_error("failed to duplicate shm channel");
+      }
+      return {ring, theirs};
+    }
+    case Value::Tee: {
+      if (id == 0)
+        throw std::runtime_error("tee applies to output streams only");
+      // child -> source -> relay -> capture -> us, and relay -> target
+      int source[2], capture[2];
+      if (::pipe2(source, O_CLOEXEC) == -1)
+        throw std::runtime_error("Failed to create pipe");
+      if (::pipe2(capture, O_CLOEXEC) == -1) {
+        close(source[0]);
+        close(source[1]);
+        throw std::runtime_error("Failed to create pipe");
+      }
+      int target = fcntl(tee_target, F_DUPFD_CLOEXEC, 0);
+      if (target == -1) {
+        for (int fd : {source[0], source[1], capture[0], capture[1]})
+          close(fd);
+        throw std::runtime_error("failed to duplicate tee target");
+      }
+      // ends once every copy of the child's end is closed
+      std::thread(FileDesc::tee_relay, source[0], capture[1], target).detach();
+      return {capture[0], source[1]};
+    }
     default:
       return {std::nullopt, std::nullopt};
     }
   }
 };
-Stdio::Stdio(Value v) : impl_(std::make_unique<Impl>(v)) {}
+Stdio::Stdio(Value v) { impl_->value = v; }
 Stdio::~Stdio() = default;
-Stdio::Stdio(Stdio &&other) { *this = std::move(other); };
+Stdio::Stdio(Stdio &&other) : impl_(std::move(other.impl_)) {}
 Stdio &Stdio::operator=(Stdio &&other) {
   if (&other != this)
     this->impl_ = std::move(other.impl_);
@@ -248,53 +988,559 @@ Stdio &Stdio::operator=(Stdio &&other) {
 Stdio Stdio::pipe() { return Stdio(Value::NewPipe); }
 Stdio Stdio::inherit() { return Stdio(Value::Inherit); }
 Stdio Stdio::null() { return Stdio(Value::Null); }
+Stdio Stdio::shm_channel(size_t capacity) {
+  Stdio io = Stdio(Value::ShmChannel);
+  io.impl_->capacity = capacity;
+  return io;
+}
+Stdio Stdio::tee(int target_fd) {
+  Stdio io = Stdio(Value::Tee);
+  io.impl_->tee_target = target_fd;
+  return io;
+}
 Stdio Stdio::from(ChildStdin other) {
   Stdio io = Stdio(Value::FromPipe);
-  io.impl_->other = other.impl_->fd;
+  io.impl_->other = std::move(*other.impl_);
   return io;
 }
 Stdio Stdio::from(ChildStdout other) {
+  if (not other.impl_->pending.empty())
+    throw std::runtime_error("output read ahead cannot be handed to a child");
   Stdio io = Stdio(Value::FromPipe);
-  io.impl_->other = other.impl_->fd;
+  io.impl_->other = std::move(*other.impl_);
   return io;
 }
 Stdio Stdio::from(ChildStderr other) {
+  if (not other.impl_->pending.empty())
+    throw std::runtime_error("output read ahead cannot be handed to a child");
   Stdio io = Stdio(Value::FromPipe);
-  io.impl_->other = other.impl_->fd;
+  io.impl_->other = std::move(*other.impl_);
   return io;
 }
 
 /*============================================================================*/
+struct Reaper::Impl {
+  struct Entry {
+    pid_t pid;
+    std::promise<ExitStatus> exit;
+  };
+  static constexpr size_t batch = 64;
+
+  int epoll_fd;
+  int wake_fd;
+  std::mutex mutex;
+  std::unordered_map<int, Entry> entries; // keyed by pidfd
+  std::thread worker;
+  static inline std::atomic<bool> watch_all{false};
+
+  Impl() {
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+      throw std::runtime_error("failed to create reaper epoll set");
+    if ((wake_fd = eventfd(0, EFD_CLOEXEC)) == -1)
+      throw std::runtime_error("failed to create reaper eventfd");
+    epoll_event ev{.events = EPOLLIN, .data = {.fd = wake_fd}};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == -1)
+      throw std::runtime_error("failed to register reaper eventfd");
+    worker = std::thread([this] { run(); });
+  }
+  ~Impl() {
+    uint64_t one = 1;
+    ssize_t ignored = ::write(wake_fd, &one, sizeof(one));
+    (void)ignored;
+    if (worker.joinable())
+      worker.join();
+    for (auto &[pidfd, entry] : entries)
+      close(pidfd);
+    close(wake_fd);
+    close(epoll_fd);
+  }
+  static Impl &instance() {
+    static Impl reaper;
+    return reaper;
+  }
+
+  std::future<ExitStatus> watch(pid_t pid) {
+    int pidfd = pidfd_open(pid);
+    if (pidfd == -1)
+      throw std::runtime_error("failed to open pidfd for " +
+                               std::to_string(pid));
+    std::future<ExitStatus> exit;
+    {
+      std::lock_guard lock(mutex);
+      auto &entry = entries[pidfd];
+      entry.pid = pid;
+      exit = entry.exit.get_future();
+    }
+    epoll_event ev{.events = EPOLLIN, .data = {.fd = pidfd}};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfd, &ev) == -1) {
+      std::lock_guard lock(mutex);
+      entries.erase(pidfd);
+      close(pidfd);
+      throw std::runtime_error("failed to watch pidfd");
+    }
+    return exit;
+  }
+
+  void run() {
+    epoll_event events[batch];
+    while (true) {
+      int ready = epoll_wait(epoll_fd, events, batch, -1);
+      if (ready == -1) {
+        if (errno == EINTR)
+          continue;
+        return;
+      }
+      std::lock_guard lock(mutex);
+      for (int i = 0; i < ready; i += 1) {
+        int fd = events[i].data.fd;
+        if (fd == wake_fd)
+          return;
+        auto it = entries.find(fd);
+        if (it == entries.end())
+          continue;
+        int wstatus;
+        if (waitpid(it->second.pid, &wstatus, WNOHANG) == 0)
+          continue; // not exited yet, e.g. a stop notification
+        ExitStatus status;
+        status.impl_->code = exit_code_of(wstatus);
+        it->second.exit.set_value(std::move(status));
+        close(fd); // also drops it from the epoll set
+        entries.erase(it);
+      }
+    }
+  }
+};
+
+void Reaper::start() {
+  Impl::instance();
+  Impl::watch_all.store(true, std::memory_order_release);
+}
+bool Reaper::running() {
+  return Impl::watch_all.load(std::memory_order_acquire);
+}
+
+/*============================================================================*/
+// Bind a datagram socket for Command::notify_socket under a fresh abstract
+// name, returned as NOTIFY_SOCKET spells it ("@" for the leading NUL). The
+// random part keeps other local processes from guessing it.
+static int open_notify_socket(string &address) {
+  static std::atomic<unsigned> counter{0};
+  uint64_t nonce = 0;
+  if (getrandom(&nonce, sizeof(nonce), 0) != sizeof(nonce))
+    nonce = std::chrono::steady_clock::now().time_since_epoch().count();
+  char name[80];
+  int length = snprintf(name, sizeof(name), "process-notify/%d/%u/%016llx",
+                        static_cast<int>(getpid()), counter.fetch_add(1),
+                        static_cast<unsigned long long>(nonce));
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path + 1, name, length);
+  OwnedFd fd(socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0));
+  int on = 1;
+  if (fd.fd == -1 ||
+      bind(fd.fd, reinterpret_cast<sockaddr *>(&addr),
+           offsetof(sockaddr_un, sun_path) + 1 + length) == -1 ||
+      setsockopt(fd.fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) == -1)
+    throw std::runtime_error(string("failed to create notify socket: ") +
+                             strerror(errno));
+  address = "@" + string(name, length);
+  return fd.release();
+}
+
+// our end of a notify socket and what the child has said on it so far
+struct NotifyState {
+  OwnedFd socket;
+  std::deque<Notification> queue;
+  bool ready = false;
+  bool triggered = false;                  // WATCHDOG=trigger
+  std::chrono::microseconds watchdog{0};   // zero: no watchdog
+  std::chrono::steady_clock::time_point heartbeat = std::chrono::steady_clock::now();
+
+  // Take every datagram waiting on the socket, ignoring those sent by
+  // another user, and apply the fields the watchdog and readiness track.
+  void receive() {
+    char data[4096];
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(ucred))];
+    while (true) {
+      iovec iov{data, sizeof(data)};
+      msghdr message{};
+      message.msg_iov = &iov;
+      message.msg_iovlen = 1;
+      message.msg_control = control;
+      message.msg_controllen = sizeof(control);
+      ssize_t got = recvmsg(socket.fd, &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+      if (got == -1 && errno == EINTR)
+        continue;
+      if (got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+      if (got == -1)
+        throw std::runtime_error("failed to read notify socket");
+      const ucred *sender = nullptr;
+      for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg;
+           cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_CREDENTIALS)
+          sender = reinterpret_cast<const ucred *>(CMSG_DATA(cmsg));
+        else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+          for (int *fd = reinterpret_cast<int *>(CMSG_DATA(cmsg));
+               reinterpret_cast<char *>(fd) <
+               reinterpret_cast<char *>(cmsg) + cmsg->cmsg_len;
+               fd += 1)
+            close(*fd); // FDSTORE=1 is not supported
+      }
+      if (not sender || sender->uid != getuid() ||
+          (message.msg_flags & MSG_TRUNC))
+        continue;
+      Notification notification;
+      notification.pid = sender->pid;
+      std::string_view text(data, got);
+      while (not text.empty()) {
+        size_t end = std::min(text.find('\n'), text.size());
+        std::string_view line = text.substr(0, end);
+        text.remove_prefix(std::min(end + 1, text.size()));
+        size_t equals = line.find('=');
+        if (equals == std::string_view::npos)
+          continue;
+        notification.fields.emplace_back(line.substr(0, equals),
+                                         line.substr(equals + 1));
+      }
+      if (notification.fields.empty())
+        continue;
+      apply(notification);
+      queue.push_back(std::move(notification));
+    }
+  }
+  void apply(const Notification &notification) {
+    for (const auto &[key, value] : notification.fields) {
+      if (key == "READY" && value == "1") {
+        ready = true;
+      } else if (key == "WATCHDOG" && value == "1") {
+        heartbeat = std::chrono::steady_clock::now();
+      } else if (key == "WATCHDOG" && value == "trigger") {
+        triggered = true;
+      } else if (key == "WATCHDOG_USEC") {
+        char *end = nullptr;
+        unsigned long long usec = strtoull(value.c_str(), &end, 10);
+        if (end != value.c_str() && *end == '\0') {
+          watchdog = std::chrono::microseconds(usec);
+          heartbeat = std::chrono::steady_clock::now();
+        }
+      }
+    }
+  }
+  // Sleep until a datagram arrives, the child (pidfd) exits or the deadline
+  // passes, then receive. False once there is nothing more to wait for.
+  bool wait(int pidfd, std::chrono::steady_clock::time_point deadline) {
+    if (pidfd == -1) { // already reaped
+      receive();
+      return false;
+    }
+    while (true) {
+      pollfd fds[2] = {{.fd = socket.fd, .events = POLLIN, .revents = 0},
+                       {.fd = pidfd, .events = POLLIN, .revents = 0}};
+      auto left = std::chrono::ceil<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      int ready = poll(fds, 2, std::max<int>(0, left.count()));
+      if (ready == -1 && errno == EINTR)
+        continue;
+      if (ready == -1)
+        throw std::runtime_error("failed to poll notify socket");
+      // a child's last datagrams are queued before its exit is visible
+      receive();
+      return ready > 0 && not fds[1].revents;
+    }
+  }
+};
+
+// An adopted child's entry with the backend that made it. A wait takes the
+// entry off the backend; a handle that goes away before that hands it back
+// with release, so backends do not hold on to children nobody waits for.
+struct BackendEntry {
+  std::shared_ptr<Backend> backend;
+  int id = -1;
+  bool claimed = false; // by a wait
+
+  BackendEntry() = default;
+  BackendEntry(BackendEntry &&other)
+      : backend(std::move(other.backend)), id(other.id), claimed(other.claimed) {}
+  BackendEntry &operator=(BackendEntry &&other) {
+    if (this != &other) {
+      drop();
+      backend = std::move(other.backend);
+      id = other.id;
+      claimed = other.claimed;
+    }
+    return *this;
+  }
+  ~BackendEntry() { drop(); }
+  explicit operator bool() const { return backend != nullptr; }
+  Backend *operator->() const { return backend.get(); }
+  void drop() {
+    if (backend && not claimed) {
+      try {
+        backend->release(id);
+      } catch (...) { // runs in destructors
+      }
+    }
+    backend.reset();
+  }
+};
+
 struct Child::Impl {
   Process pi;
+  optional<std::future<ExitStatus>> exit; // set once handed to the reaper
+  bool waited_async = false;
+  bool group_leader = false; // pid is also the process group id
+  bool reaped = false;       // by our own wait; the pid may be reused
+  // Held while the reaper may reap the child behind our back, so that
+  // signals never reach a process that took over its pid.
+  OwnedFd pidfd;
+  vector<pair<int, OwnedFd>> extra_ends; // child fd, our end of its pipe
+  BackendEntry backend;                  // set for children a backend adopted
+  int backend_pid = -1;                  // the process behind it, if any
+  std::unique_ptr<NotifyState> notify;   // with Command::notify_socket
+
+  Impl() : pi{.pid = -1} {}
+  OwnedFd take_end(int child_fd) {
+    for (auto &[fd, end] : extra_ends)
+      if (fd == child_fd && end.fd >= 0)
+        return std::move(end);
+    return {};
+  }
+  void start(pid_t pid) {
+    pi.pid = pid;
+    if (Reaper::running())
+      watch();
+  }
+  void watch() {
+    if (pidfd.fd == -1 && (pidfd.fd = pidfd_open(pi.pid)) == -1)
+      throw std::runtime_error("failed to open pidfd for " +
+                               std::to_string(pi.pid));
+    exit = Reaper::Impl::instance().watch(pi.pid);
+  }
+  // a pidfd of our own on the child, -1 once it is reaped or when a
+  // backend stands in for it
+  OwnedFd open_pidfd() {
+    if (reaped || backend)
+      return {};
+    if (pidfd.fd >= 0)
+      return OwnedFd(fcntl(pidfd.fd, F_DUPFD_CLOEXEC, 0));
+    return OwnedFd(pidfd_open(pi.pid)); // unreaped, so the pid is still its
+  }
+  // false when the child is gone; then there is nothing left to signal
+  bool signal(int sig) {
+    if (reaped)
+      return false;
+    int sent = pidfd.fd >= 0
+                   ? syscall(SYS_pidfd_send_signal, pidfd.fd, sig, nullptr, 0)
+                   : ::kill(pi.pid, sig);
+    if (sent == 0)
+      return true;
+    if (errno == ESRCH)
+      return false;
+    throw std::runtime_error("failed to signal process " +
+                             std::to_string(pi.pid) + ": " + strerror(errno));
+  }
 
-  Impl(Process pi) : pi(pi) {}
+  static Child adopt(std::shared_ptr<Backend> backend, int id,
+                     const int (&fds)[3], int pid) {
+    Child child;
+    if (fds[0] >= 0) {
+      child.io_stdin.emplace();
+      child.io_stdin->impl_->fd = fds[0];
+    }
+    if (fds[1] >= 0) {
+      child.io_stdout.emplace();
+      child.io_stdout->impl_->fd = fds[1];
+    }
+    if (fds[2] >= 0) {
+      child.io_stderr.emplace();
+      child.io_stderr->impl_->fd = fds[2];
+    }
+    child.impl_->backend.backend = std::move(backend);
+    child.impl_->backend.id = id;
+    child.impl_->backend_pid = pid;
+    return child;
+  }
+  // hand what wait_for_output read ahead to the captures first
+  static void take_read_ahead(Child &child, FileDesc::Capture &out,
+                              FileDesc::Capture &err) {
+    if (child.io_stdout) {
+      string ahead = child.io_stdout->impl_->take_all();
+      out.append(ahead.data(), ahead.size());
+    }
+    if (child.io_stderr) {
+      string ahead = child.io_stderr->impl_->take_all();
+      err.append(ahead.data(), ahead.size());
+    }
+  }
+  // take the fds out of child's stdio handles, -1 where it has none
+  static void release_stdio(Child &child, int (&fds)[3]) {
+    fds[0] = child.io_stdin ? child.io_stdin->impl_->release() : -1;
+    fds[1] = child.io_stdout ? child.io_stdout->impl_->release() : -1;
+    fds[2] = child.io_stderr ? child.io_stderr->impl_->release() : -1;
+    child.io_stdin.reset();
+    child.io_stdout.reset();
+    child.io_stderr.reset();
+  }
 
-  int id() { return pi.pid; }
-  void kill() { pi.kill(); }
+  NotifyState &notify_state() {
+    if (not notify)
+      throw std::runtime_error("child was not spawned with a notify socket");
+    return *notify;
+  }
+  int id() { return backend ? backend_pid : pi.pid; }
+  void kill() {
+    if (backend)
+      backend->kill(backend.id);
+    else
+      signal(SIGKILL);
+  }
   ExitStatus wait() {
-    int code = pi.wait();
+    if (waited_async)
+      throw std::runtime_error("child is already awaited through wait_async");
+    if (backend) {
+      backend.claimed = true;
+      ExitStatus status;
+      status.impl_->code = backend->wait(backend.id);
+      return status;
+    }
+    if (exit) {
+      ExitStatus status = exit->get();
+      exit.reset();
+      reaped = true;
+      return status;
+    }
     ExitStatus status;
-    status.impl_->code = code;
+    status.impl_->code = pi.wait();
+    reaped = true;
+    return status;
+  }
+  std::future<ExitStatus> wait_async() {
+    if (waited_async)
+      throw std::runtime_error("child is already awaited through wait_async");
+    if (backend) {
+      waited_async = true;
+      backend.claimed = true;
+      auto waiter = [backend = backend.backend, id = backend.id] {
+        ExitStatus status;
+        status.impl_->code = backend->wait(id);
+        return status;
+      };
+      return std::async(std::launch::async, std::move(waiter));
+    }
+    if (not exit)
+      watch();
+    waited_async = true;
+    auto future = std::move(*exit);
+    exit.reset();
+    return future;
+  }
+  // wait for the child to exit without reaping it
+  bool exited_within(std::chrono::milliseconds timeout) {
+    if (exit)
+      return exit->wait_for(timeout) == std::future_status::ready;
+    if (reaped)
+      return true;
+    int pidfd = pidfd_open(pi.pid);
+    if (pidfd == -1) {
+      siginfo_t info{};
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      do {
+        if (waitid(P_PID, pi.pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+            info.si_pid == pi.pid)
+          return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      } while (std::chrono::steady_clock::now() < deadline);
+      return false;
+    }
+    pollfd pfd{.fd = pidfd, .events = POLLIN, .revents = 0};
+    int ready;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    do {
+      auto left = std::chrono::ceil<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      ready = poll(&pfd, 1, std::max<int>(0, left.count()));
+    } while (ready == -1 && errno == EINTR);
+    close(pidfd);
+    return ready == 1;
+  }
+  ExitStatus terminate_tree(std::chrono::milliseconds grace) {
+    if (backend) {
+      kill();
+      return wait();
+    }
+    // the group outlives a reaped leader as long as members remain in it,
+    // so its id cannot be reused; a lone child is signalled safely
+    auto send = [&](int sig) {
+      if (group_leader)
+        ::kill(-pi.pid, sig);
+      else
+        signal(sig);
+    };
+    send(SIGTERM);
+    if (not exited_within(grace) || group_leader) {
+      // stragglers of the group are killed even when the leader left in time
+      send(SIGKILL);
+    }
+    ExitStatus status = wait();
+    if (group_leader) {
+      // descendants reparented to us as subreaper
+      while (waitpid(-pi.pid, nullptr, 0) > 0 || errno == EINTR) {
+      }
+    }
     return status;
   }
 };
 
-Child::Child() : impl_(nullptr){};
-Child::~Child(){};
-Child::Child(Child &&other) { *this = std::move(other); };
+Child::Child() {}
+Child::~Child() {}
+Child::Child(Child &&other)
+    : io_stdin(std::move(other.io_stdin)),
+      io_stdout(std::move(other.io_stdout)),
+      io_stderr(std::move(other.io_stderr)), impl_(std::move(other.impl_)) {}
 Child &Child::operator=(Child &&other) {
   if (&other != this) {
+    this->io_stdin = std::move(other.io_stdin);
+    this->io_stdout = std::move(other.io_stdout);
+    this->io_stderr = std::move(other.io_stderr);
     this->impl_ = std::move(other.impl_);
   }
   return *this;
 }
 
 int Child::id() { return impl_->id(); }
-ExitStatus Child::wait() { return impl_->wait(); }
+ExitStatus Child::wait() {
+  io_stdin.reset(); // a child reading stdin to the end would never exit
+  return impl_->wait();
+}
+std::future<ExitStatus> Child::wait_async() { return impl_->wait_async(); }
+ExitStatus Child::terminate_tree(std::chrono::milliseconds grace) {
+  return impl_->terminate_tree(grace);
+}
 void Child::kill() { impl_->kill(); }
+std::optional<ChildStdin> Child::take_in(int child_fd) {
+  OwnedFd end = impl_->take_end(child_fd);
+  if (end.fd < 0)
+    return std::nullopt;
+  std::optional<ChildStdin> handle(std::in_place);
+  handle->impl_->fd = end.release();
+  return handle;
+}
+std::optional<ChildStdout> Child::take_out(int child_fd) {
+  OwnedFd end = impl_->take_end(child_fd);
+  if (end.fd < 0)
+    return std::nullopt;
+  std::optional<ChildStdout> handle(std::in_place);
+  handle->impl_->fd = end.release();
+  return handle;
+}
 Output Child::wait_with_output() {
+  io_stdin.reset();
   Output output;
+  if (io_stdout)
+    output.std_out = io_stdout->impl_->take_all();
+  if (io_stderr)
+    output.std_err = io_stderr->impl_->take_all();
   if (io_stdout and not io_stderr) {
     this->io_stdout->read_to_string(output.std_out);
   } else if (not io_stdout and io_stderr) {
@@ -307,35 +1553,604 @@ Output Child::wait_with_output() {
   output.status = this->wait();
   return output;
 }
+Output Child::wait_with_output(size_t spill_threshold, const string &directory) {
+  io_stdin.reset();
+  Output output;
+  FileDesc::Capture out{&output.std_out, spill_threshold, directory};
+  FileDesc::Capture err{&output.std_err, spill_threshold, directory};
+  Impl::take_read_ahead(*this, out, err);
+  FileDesc::communicate(-1, nullptr, io_stdout ? io_stdout->impl_->fd : -1, out,
+                        io_stderr ? io_stderr->impl_->fd : -1, err);
+  if (out.spill >= 0)
+    output.std_out_file = SpillFile(out.take_spill());
+  if (err.spill >= 0)
+    output.std_err_file = SpillFile(err.take_spill());
+  output.status = this->wait();
+  return output;
+}
 
-/*============================================================================*/
-class Command::Impl {
-  string app;
-  vector<string> args;
-  optional<Stdio> io_stdin;
-  optional<Stdio> io_stdout;
-  optional<Stdio> io_stderr;
-  optional<string> cwd;
-  bool inherit_env;
-  vector<pair<string, string>> envs;
+ExitStatus Child::wait_each(detail::SinkRef out, detail::SinkRef err) {
+  io_stdin.reset();
+  FileDesc::Capture out_capture{.sink = out}, err_capture{.sink = err};
+  Impl::take_read_ahead(*this, out_capture, err_capture);
+  FileDesc::communicate(-1, nullptr, io_stdout ? io_stdout->impl_->fd : -1,
+                        out_capture, io_stderr ? io_stderr->impl_->fd : -1,
+                        err_capture);
+  return this->wait();
+}
 
-public:
-  Impl()
-      : app("sh"), args(vector<string>()), io_stdin(std::nullopt),
-        io_stdout(std::nullopt), io_stderr(std::nullopt), inherit_env(true) {}
-  ~Impl() = default;
+OutputPattern OutputPattern::literal(string text) {
+  if (text.empty())
+    throw std::runtime_error("empty output pattern");
+  OutputPattern pattern(Kind::Literal);
+  pattern.text_ = std::move(text);
+  return pattern;
+}
+OutputPattern OutputPattern::regex(string expression) {
+  std::regex compiled(expression); // reject a bad expression here
+  OutputPattern pattern(Kind::Regex);
+  pattern.text_ = std::move(expression);
+  return pattern;
+}
+OutputPattern OutputPattern::line(std::function<bool(std::string_view)> predicate) {
+  OutputPattern pattern(Kind::Line);
+  pattern.predicate_ = std::move(predicate);
+  return pattern;
+}
+
+optional<string> Child::wait_for_output(const OutputPattern &pattern,
+                                        std::chrono::milliseconds timeout) {
+  using Kind = OutputPattern::Kind;
+  optional<std::regex> compiled;
+  if (pattern.kind_ == Kind::Regex)
+    compiled.emplace(pattern.text_);
+  auto line_matches = [&](std::string_view line) {
+    if (not line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    if (compiled)
+      return std::regex_search(line.begin(), line.end(), *compiled);
+    return pattern.predicate_(line);
+  };
+  // Search what end has buffered past its scan mark. Without a match the
+  // mark moves past what was searched, short of the tail that could start
+  // a literal; with one it moves past the line of the match, whatever the
+  // kind of pattern, so a later call resumes on the next line.
+  auto scan = [&](ReadEnd &end, bool ended) -> optional<string> {
+    const string &text = end.pending;
+    if (pattern.kind_ == Kind::Literal) {
+      const string &needle = pattern.text_;
+      size_t at = text.find(needle, end.scanned);
+      if (at == string::npos) {
+        if (text.size() >= needle.size())
+          end.scanned = std::max(end.scanned, text.size() - needle.size() + 1);
+        return std::nullopt;
+      }
+      size_t first = text.rfind('\n', at);
+      first = first == string::npos ? 0 : first + 1;
+      size_t last = std::min(text.find('\n', at), text.size());
+      end.scanned = std::min(last + 1, text.size());
+      return text.substr(first, last - first);
+    }
+    size_t newline;
+    while ((newline = text.find('\n', end.scanned)) != string::npos) {
+      std::string_view line(text.data() + end.scanned, newline - end.scanned);
+      end.scanned = newline + 1;
+      if (line_matches(line))
+        return string(line);
+    }
+    if (ended && end.scanned < text.size()) {
+      std::string_view line(text.data() + end.scanned, text.size() - end.scanned);
+      end.scanned = text.size();
+      if (line_matches(line))
+        return string(line);
+    }
+    return std::nullopt;
+  };
+
+  struct Watched {
+    ReadEnd *end;
+    bool open = true;
+  };
+  vector<Watched> watched;
+  if (io_stdout)
+    watched.push_back({&*io_stdout->impl_});
+  if (io_stderr)
+    watched.push_back({&*io_stderr->impl_});
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::byte chunk[64 * 1024];
+  while (true) {
+    for (Watched &stream : watched)
+      if (auto found = scan(*stream.end, not stream.open))
+        return found;
+    vector<pollfd> fds;
+    for (Watched &stream : watched)
+      if (stream.open)
+        fds.push_back({.fd = stream.end->fd, .events = POLLIN, .revents = 0});
+    if (fds.empty())
+      return std::nullopt;
+    auto left = std::chrono::ceil<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    int ready = poll(fds.data(), fds.size(), std::max<int>(0, left.count()));
+    if (ready == -1 && errno == EINTR)
+      continue;
+    if (ready == -1)
+      throw std::runtime_error("failed to poll child output");
+    if (ready == 0)
+      return std::nullopt;
+    for (Watched &stream : watched) {
+      auto polled = std::find_if(fds.begin(), fds.end(), [&](const pollfd &fd) {
+        return stream.open && fd.fd == stream.end->fd;
+      });
+      if (polled == fds.end() || polled->revents == 0)
+        continue;
+      size_t got = FileDesc::read(stream.end->fd, chunk);
+      stream.end->pending.append(reinterpret_cast<const char *>(chunk), got);
+      stream.open = got > 0;
+    }
+  }
+}
+
+bool Child::wait_ready(std::chrono::milliseconds timeout) {
+  NotifyState &state = impl_->notify_state();
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  state.receive();
+  OwnedFd pidfd = impl_->open_pidfd();
+  while (not state.ready && state.wait(pidfd.fd, deadline)) {
+  }
+  return state.ready;
+}
+
+optional<Notification> Child::next_notification(std::chrono::milliseconds timeout) {
+  NotifyState &state = impl_->notify_state();
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  state.receive();
+  OwnedFd pidfd = impl_->open_pidfd();
+  while (state.queue.empty() && state.wait(pidfd.fd, deadline)) {
+  }
+  if (state.queue.empty())
+    return std::nullopt;
+  Notification notification = std::move(state.queue.front());
+  state.queue.pop_front();
+  return notification;
+}
+
+bool Child::watchdog_expired() {
+  NotifyState &state = impl_->notify_state();
+  state.receive();
+  if (state.triggered)
+    return true;
+  return state.watchdog.count() > 0 &&
+         std::chrono::steady_clock::now() - state.heartbeat > state.watchdog;
+}
+
+/*============================================================================*/
+struct SpillFile::Impl {
+  OwnedFd file;
+  size_t length;
+  size_t offset = 0;
+  void *map = nullptr;
+  Impl(int fd) : file(fd) {
+    struct stat info;
+    if (::fstat(fd, &info) == -1)
+      throw std::runtime_error("failed to stat spill file");
+    length = info.st_size;
+  }
+  ~Impl() {
+    if (map)
+      ::munmap(map, length);
+  }
+};
+SpillFile::SpillFile(int fd) : impl_(std::make_unique<Impl>(fd)) {}
+SpillFile::~SpillFile() = default;
+SpillFile::SpillFile(SpillFile &&other) = default;
+SpillFile &SpillFile::operator=(SpillFile &&other) = default;
+size_t SpillFile::size() const { return impl_->length; }
+size_t SpillFile::read(span<std::byte> buffer) {
+  size_t got = read_at(impl_->offset, buffer);
+  impl_->offset += got;
+  return got;
+}
+size_t SpillFile::read_at(size_t offset, span<std::byte> buffer) const {
+  ssize_t got;
+  while ((got = ::pread(impl_->file.fd, buffer.data(), buffer.size(), offset)) ==
+             -1 &&
+         errno == EINTR) {
+  }
+  if (got == -1)
+    throw std::runtime_error(string("failed to read spill file: ") +
+                             strerror(errno));
+  return static_cast<size_t>(got);
+}
+std::string_view SpillFile::view() {
+  if (impl_->length == 0)
+    return {};
+  if (not impl_->map) {
+    void *map = ::mmap(nullptr, impl_->length, PROT_READ, MAP_SHARED,
+                       impl_->file.fd, 0);
+    if (map == MAP_FAILED)
+      throw std::runtime_error(string("failed to map spill file: ") +
+                               strerror(errno));
+    impl_->map = map;
+  }
+  return {static_cast<const char *>(impl_->map), impl_->length};
+}
+native_handle_type SpillFile::native_handle() const { return impl_->file.fd; }
+PumpStats pump(SpillFile &from, int to_fd, size_t limit) {
+  off_t offset = static_cast<off_t>(from.impl_->offset);
+  PumpStats stats = FileDesc::send_file(from.impl_->file.fd, offset, to_fd, limit);
+  from.impl_->offset = static_cast<size_t>(offset);
+  return stats;
+}
+PumpStats pump(SpillFile &from, ChildStdin &to, size_t limit) {
+  return pump(from, to.native_handle(), limit);
+}
+
+/*============================================================================*/
+namespace {
+uint64_t fnv1a(std::string_view data, uint64_t hash = 0xcbf29ce484222325ull) {
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+string hex64(uint64_t value) {
+  char text[17];
+  snprintf(text, sizeof(text), "%016llx", (unsigned long long)value);
+  return text;
+}
+
+// entry layout: magic, key length, has code, code, stdout length, stderr
+// length, then the key, stdout and stderr bytes back to back
+struct EntryHeader {
+  char magic[4];
+  uint32_t key_len;
+  int32_t has_code;
+  int32_t code;
+  uint64_t out_len;
+  uint64_t err_len;
+};
+constexpr char entry_magic[4] = {'P', 'C', 'O', '1'};
+} // namespace
+
+struct OutputCache::Impl {
+  string dir;
+  size_t max_bytes;
+  size_t total = 0;
+  std::mutex mutex;
+
+  Impl(const string &directory, size_t limit) : dir(directory), max_bytes(limit) {
+    if (::mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST)
+      throw std::runtime_error("Failed to create cache directory " + dir +
+                               ": " + strerror(errno));
+    for (auto &entry : scan())
+      total += entry.size;
+  }
+
+  string path_of(const string &key) const {
+    return dir + "/" + hex64(fnv1a(key)) + ".out";
+  }
+
+  struct Stored {
+    string path;
+    size_t size;
+    timespec used;
+  };
+  vector<Stored> scan() const {
+    vector<Stored> entries;
+    DIR *handle = ::opendir(dir.c_str());
+    if (not handle)
+      return entries;
+    while (dirent *item = ::readdir(handle)) {
+      string name = item->d_name;
+      if (name.size() < 4 || name.compare(name.size() - 4, 4, ".out") != 0)
+        continue;
+      struct stat info;
+      string path = dir + "/" + name;
+      if (::stat(path.c_str(), &info) == 0)
+        entries.push_back({path, size_t(info.st_size), info.st_mtim});
+    }
+    ::closedir(handle);
+    return entries;
+  }
+
+  optional<Output> lookup(const string &key) {
+    std::lock_guard lock(mutex);
+    OwnedFd file(::open(path_of(key).c_str(), O_RDONLY | O_CLOEXEC));
+    if (file.fd == -1)
+      return std::nullopt;
+    struct stat info;
+    if (::fstat(file.fd, &info) == -1 || size_t(info.st_size) < sizeof(EntryHeader))
+      return std::nullopt;
+    size_t size = info.st_size;
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file.fd, 0);
+    if (map == MAP_FAILED)
+      return std::nullopt;
+    const char *base = static_cast<const char *>(map);
+    EntryHeader header;
+    memcpy(&header, base, sizeof(header));
+    optional<Output> hit;
+    // a colliding or truncated entry reads as a miss
+    if (memcmp(header.magic, entry_magic, sizeof(entry_magic)) == 0 &&
+        sizeof(header) + header.key_len + header.out_len + header.err_len == size &&
+        std::string_view(base + sizeof(header), header.key_len) == key) {
+      const char *body = base + sizeof(header) + header.key_len;
+      hit.emplace();
+      if (header.has_code)
+        hit->status.impl_->code = header.code;
+      hit->std_out.assign(body, header.out_len);
+      hit->std_err.assign(body + header.out_len, header.err_len);
+      ::futimens(file.fd, nullptr); // mtime doubles as the LRU stamp
+    }
+    ::munmap(map, size);
+    return hit;
+  }
+
+  void store(const string &key, const Output &output) {
+    std::lock_guard lock(mutex);
+    optional<int> code = output.status.impl_->code;
+    EntryHeader header;
+    memcpy(header.magic, entry_magic, sizeof(entry_magic));
+    header.key_len = key.size();
+    header.has_code = code.has_value();
+    header.code = code.value_or(0);
+    header.out_len = output.std_out.size();
+    header.err_len = output.std_err.size();
+
+    // written under a temporary name and renamed so readers in other
+    // processes never see a partial entry
+    string path = path_of(key);
+    string temp = path + ".tmp" + std::to_string(::getpid());
+    OwnedFd file(::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (file.fd == -1)
+      throw std::runtime_error("Failed to create cache entry: " +
+                               string(strerror(errno)));
+    iovec parts[4] = {
+        {&header, sizeof(header)},
+        {const_cast<char *>(key.data()), key.size()},
+        {const_cast<char *>(output.std_out.data()), output.std_out.size()},
+        {const_cast<char *>(output.std_err.data()), output.std_err.size()},
+    };
+    try {
+      FileDesc::writev_all(file.fd, parts);
+    } catch (...) {
+      ::unlink(temp.c_str());
+      throw;
+    }
+    file.reset();
+
+    struct stat old;
+    if (::stat(path.c_str(), &old) == 0)
+      total -= std::min(total, size_t(old.st_size));
+    if (::rename(temp.c_str(), path.c_str()) == -1) {
+      ::unlink(temp.c_str());
+      throw std::runtime_error("Failed to store cache entry: " +
+                               string(strerror(errno)));
+    }
+    total += sizeof(header) + key.size() + output.std_out.size() +
+             output.std_err.size();
+    if (total > max_bytes)
+      evict();
+  }
+
+  // drop least recently used entries until the store fits again
+  void evict() {
+    vector<Stored> entries = scan();
+    std::sort(entries.begin(), entries.end(), [](auto &a, auto &b) {
+      return std::tie(a.used.tv_sec, a.used.tv_nsec) <
+             std::tie(b.used.tv_sec, b.used.tv_nsec);
+    });
+    total = 0;
+    for (auto &entry : entries)
+      total += entry.size;
+    for (auto &entry : entries) {
+      if (total <= max_bytes)
+        break;
+      if (::unlink(entry.path.c_str()) == 0)
+        total -= entry.size;
+    }
+  }
+
+  void clear() {
+    std::lock_guard lock(mutex);
+    for (auto &entry : scan())
+      ::unlink(entry.path.c_str());
+    total = 0;
+  }
+};
+
+OutputCache::OutputCache(const string &directory, size_t max_bytes)
+    : impl_(std::make_unique<Impl>(directory, max_bytes)) {}
+OutputCache::~OutputCache() = default;
+OutputCache::OutputCache(OutputCache &&other) = default;
+OutputCache &OutputCache::operator=(OutputCache &&other) = default;
+optional<Output> OutputCache::lookup(const string &key) {
+  return impl_->lookup(key);
+}
+void OutputCache::store(const string &key, const Output &output) {
+  impl_->store(key, output);
+}
+size_t OutputCache::size_bytes() const {
+  std::lock_guard lock(impl_->mutex);
+  return impl_->total;
+}
+void OutputCache::clear() { impl_->clear(); }
+
+/*============================================================================*/
+namespace {
+// parse sysfs cpu/node lists such as "0-3,8,10-11"
+vector<int> parse_id_list(const string &text) {
+  vector<int> ids;
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t end = text.find(',', pos);
+    if (end == string::npos)
+      end = text.size();
+    string item = text.substr(pos, end - pos);
+    pos = end + 1;
+    if (item.empty() || item == "\n")
+      continue;
+    size_t dash = item.find('-');
+    int first = std::stoi(item.substr(0, dash));
+    int last = dash == string::npos ? first : std::stoi(item.substr(dash + 1));
+    for (int id = first; id <= last; id += 1)
+      ids.push_back(id);
+  }
+  return ids;
+}
+
+// report a failed pre-exec step to the parent and leave without unwinding
+[[noreturn]] void child_fail(int err_fd, const char *what) {
+  int err = errno;
+  char report[256];
+  size_t len = std::min(strlen(what), sizeof(report) - sizeof(err));
+  memcpy(report, &err, sizeof(err));
+  memcpy(report + sizeof(err), what, len);
+  // a single write so the parent never sees a partial report
+  ssize_t ignored = ::write(err_fd, report, sizeof(err) + len);
+  (void)ignored;
+  _exit(127);
+}
+
+// the parent's side of child_fail: empty once exec closed the pipe
+optional<string> exec_failure(int report_fd) {
+  char report[256];
+  ssize_t report_len;
+  while ((report_len = ::read(report_fd, report, sizeof(report))) == -1 &&
+         errno == EINTR) {
+  }
+  if (report_len <= static_cast<ssize_t>(sizeof(int)))
+    return std::nullopt;
+  int err;
+  memcpy(&err, report, sizeof(err));
+  return string(report + sizeof(int), report_len - sizeof(int)) + ": " +
+         strerror(err);
+}
+
+// in a child sharing our memory: handlers of ours must not run in it
+void reset_signal_handlers() {
+  for (int sig = 1; sig < NSIG; sig += 1) {
+    struct sigaction action;
+    if (sigaction(sig, nullptr, &action) == 0 && action.sa_handler != SIG_IGN &&
+        action.sa_handler != SIG_DFL) {
+      action.sa_handler = SIG_DFL;
+      action.sa_flags = 0;
+      sigaction(sig, &action, nullptr);
+    }
+  }
+}
+
+// Run body in a new child that shares our memory until it execs, like
+// vfork, but on a stack of its own, as posix_spawn does: nothing the child
+// does can clobber the frames of the suspended caller. The caller stays
+// suspended until the exec, so one stack per thread serves every spawn.
+// body must end in exec or _exit and may only make system calls; the
+// caller's errno is restored as the child shares it.
+struct ChildStack {
+  static constexpr size_t size = 256 * 1024;
+  void *base = nullptr;
+  ~ChildStack() {
+    if (base)
+      munmap(base, size);
+  }
+};
+template <class Body> pid_t clone_vfork(Body &body) {
+  thread_local ChildStack stack;
+  if (not stack.base) {
+    void *base = mmap(nullptr, ChildStack::size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED)
+      return -1;
+    stack.base = base;
+  }
+  auto entry = [](void *arg) -> int {
+    (*static_cast<Body *>(arg))();
+    _exit(127);
+  };
+  int saved = errno;
+  // the stack grows down on every architecture we build for
+  pid_t pid = clone(entry, static_cast<char *>(stack.base) + ChildStack::size,
+                    CLONE_VM | CLONE_VFORK | SIGCHLD, &body);
+  if (pid != -1)
+    errno = saved;
+  return pid;
+}
+} // namespace
+
+class Command::Impl {
+  string app;
+  string arg_block; // every argument, each followed by a NUL
+  size_t arg_count;
+  optional<Stdio> io_stdin;
+  optional<Stdio> io_stdout;
+  optional<Stdio> io_stderr;
+  optional<string> cwd;
+  bool inherit_env;
+  vector<pair<string, string>> envs;
+  vector<char *> exec_args;
+
+  // scheduling and placement
+  optional<cpu_set_t> affinity;
+  optional<pair<int, vector<unsigned long>>> mempolicy; // mode, node mask
+  optional<int> niceness;
+  optional<int> scheduler;
+  optional<int> io_priority;
+
+  // process tree control
+  bool new_group = false;
+  bool new_sess = false;
+  optional<int> death_signal;
+
+  // output caching
+  OutputCache *output_cache = nullptr;
+  vector<string> cache_envs;
+  vector<string> cache_inputs;
+
+  // captured streams past this size go to a temporary file
+  optional<size_t> spill_limit;
+  string spill_dir;
+
+  // fds beyond stdio: either one of ours passed through, or set up from a
+  // Stdio like stdin (child_reads) or stdout
+  struct ExtraFd {
+    int child_fd = -1;
+    int parent_fd = -1;
+    bool child_reads = false;
+    optional<Stdio> io = std::nullopt;
+  };
+  vector<ExtraFd> extra_fds;
+
+  // set by notify_socket: the WATCHDOG_USEC to pass, zero for none
+  optional<std::chrono::microseconds> notify_watchdog;
+
+public:
+  Impl()
+      : app("sh"), arg_count(0), io_stdin(std::nullopt),
+        io_stdout(std::nullopt), io_stderr(std::nullopt), inherit_env(true) {}
+  ~Impl() = default;
   void set_app(string str) { app = str; }
-  void add_args(const string &arg) { args.push_back(arg); }
+  void add_args(std::string_view arg) {
+    if (arg.find('\0') != std::string_view::npos)
+      throw std::runtime_error("argument contains a nul byte");
+    arg_block.append(arg);
+    arg_block.push_back('\0');
+    arg_count += 1;
+  }
   void set_stdin(Stdio io) { io_stdin = std::move(io); }
   void set_stdout(Stdio io) { io_stdout = std::move(io); }
   void set_stderr(Stdio io) { io_stderr = std::move(io); }
 
-  vector<char *> build_args() {
-    std::vector<char *> exec_args = {const_cast<char *>(app.c_str())};
-    if (!args.empty()) {
-      for (const auto &arg : args) {
-        exec_args.push_back(const_cast<char *>(arg.c_str()));
-      }
+  // argv points into the argument block; rebuilt in place so repeated
+  // spawns reuse the same storage
+  vector<char *> &build_args() {
+    exec_args.clear();
+    exec_args.reserve(arg_count + 2);
+    exec_args.push_back(const_cast<char *>(app.c_str()));
+    for (size_t pos = 0; pos < arg_block.size();) {
+      char *arg = arg_block.data() + pos;
+      exec_args.push_back(arg);
+      pos += strlen(arg) + 1;
     }
     exec_args.push_back(nullptr); // execvp needs a null-terminated array
     return exec_args;
@@ -345,13 +2160,167 @@ public:
     //   throw std::runtime_error(std::format("{} not exist", path));
     cwd = path;
   }
+  optional<string> resolve_cwd() const {
+    if (not cwd)
+      return std::nullopt;
+    const string &path = *cwd;
+    if (not path.empty() && path.front() == '~') {
+      char *home = getenv("HOME");
+      if (not home) {
+        throw std::runtime_error("HOME environment variable not set");
+      }
+      return string(home) + path.substr(1);
+    }
+    return path;
+  }
+  void set_notify(std::chrono::microseconds watchdog) { notify_watchdog = watchdog; }
+  bool notifies() const { return notify_watchdog.has_value(); }
   void add_env(const string &key, const string &value) {
     envs.push_back({key, value});
   };
   void clear_env() { inherit_env = false; }
-  void setup_io(Stdio::Value mode) {
+  void set_affinity(const vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+      if (cpu < 0 || cpu >= CPU_SETSIZE)
+        throw std::runtime_error("cpu id out of range: " + std::to_string(cpu));
+      CPU_SET(cpu, &set);
+    }
+    affinity = set;
+  }
+  void set_mempolicy(MemPolicy policy, const vector<int> &nodes) {
+    constexpr size_t bits = 8 * sizeof(unsigned long);
+    vector<unsigned long> mask;
+    for (int node : nodes) {
+      if (node < 0 || node >= 1024)
+        throw std::runtime_error("numa node out of range: " +
+                                 std::to_string(node));
+      if (mask.size() <= node / bits)
+        mask.resize(node / bits + 1, 0);
+      mask[node / bits] |= 1UL << (node % bits);
+    }
+    int mode = MPOL_DEFAULT;
+    switch (policy) {
+    case MemPolicy::Default:
+      mode = MPOL_DEFAULT;
+      mask.clear();
+      break;
+    case MemPolicy::Preferred:
+      mode = MPOL_PREFERRED;
+      break;
+    case MemPolicy::Bind:
+      mode = MPOL_BIND;
+      break;
+    case MemPolicy::Interleave:
+      mode = MPOL_INTERLEAVE;
+      break;
+    }
+    if (mode != MPOL_DEFAULT && mode != MPOL_PREFERRED && mask.empty())
+      throw std::runtime_error("memory policy needs at least one numa node");
+    mempolicy = {mode, std::move(mask)};
+  }
+  void set_nice(int increment) { niceness = increment; }
+  void set_scheduler(SchedPolicy policy) {
+    switch (policy) {
+    case SchedPolicy::Other:
+      scheduler = SCHED_OTHER;
+      break;
+    case SchedPolicy::Batch:
+      scheduler = SCHED_BATCH;
+      break;
+    case SchedPolicy::Idle:
+      scheduler = SCHED_IDLE;
+      break;
+    }
+  }
+  void set_ioprio(IoPriority io_class, int level) {
+    if (level < 0 || level > 7)
+      throw std::runtime_error("io priority level must be in [0, 7]");
+    int cls = static_cast<int>(io_class);
+    io_priority = (cls << IOPRIO_CLASS_SHIFT) | (cls == 0 ? 0 : level);
+  }
+  void set_process_group(bool enable) { new_group = enable; }
+  void set_session(bool enable) { new_sess = enable; }
+  void set_death_signal(int signal) { death_signal = signal; }
+  void set_cache(OutputCache &cache) { output_cache = &cache; }
+  void add_cache_env(std::string_view key) { cache_envs.emplace_back(key); }
+  void add_cache_input(std::string_view path) { cache_inputs.emplace_back(path); }
+  OutputCache *cache() const { return output_cache; }
+  void set_spill(size_t bytes, const string &directory) {
+    spill_limit = bytes;
+    spill_dir = directory;
+  }
+  const optional<size_t> &spill() const { return spill_limit; }
+  const string &spill_directory() const { return spill_dir; }
+  void add_extra_fd(ExtraFd extra) {
+    if (extra.child_fd < 0 || (extra.io && extra.child_fd <= STDERR_FILENO))
+      throw std::runtime_error("invalid child fd " +
+                               std::to_string(extra.child_fd));
+    extra_fds.push_back(std::move(extra));
+  }
+
+  // everything the child's output is assumed to depend on, length-prefixed
+  // so no two distinct commands share a key
+  string cache_key() const {
+    string key = "v1";
+    auto field = [&](std::string_view value) {
+      key += std::to_string(value.size());
+      key.push_back(':');
+      key.append(value);
+    };
+    // the program PATH selects, and the directory it runs in as an absolute
+    // path: relative ones resolve against ours
+    ExecImage image = resolve_image();
+    field(image.path.empty() ? app : image.path);
+    field(arg_block);
+    string dir = resolve_cwd().value_or("");
+    if (dir.empty() || dir.front() != '/') {
+      char here[PATH_MAX];
+      if (not getcwd(here, sizeof(here)))
+        throw std::runtime_error(string("failed to get working directory: ") +
+                                 strerror(errno));
+      dir = dir.empty() ? string(here) : here + ("/" + dir);
+    }
+    field(dir);
+    // variables set on the command are always part of the key; of the
+    // inherited environment only the names opted in with cache_env are
+    field(inherit_env ? "inherit" : "clear");
+    for (const auto &[name, value] : envs) {
+      field(name);
+      field(value);
+    }
+    for (const auto &name : cache_envs) {
+      if (not inherit_env)
+        break;
+      bool set = false;
+      for (const auto &entry : envs)
+        set = set || entry.first == name;
+      if (set)
+        continue;
+      const char *value = getenv(name.c_str());
+      field(name);
+      field(value ? "=" + string(value) : "-");
+    }
+    for (const auto &path : cache_inputs) {
+      field(path);
+      OwnedFd file(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+      if (file.fd == -1) {
+        field("-");
+        continue;
+      }
+      uint64_t hash = fnv1a({});
+      std::byte chunk[64 * 1024];
+      while (size_t got = FileDesc::read(file.fd, chunk))
+        hash = fnv1a({reinterpret_cast<const char *>(chunk), got}, hash);
+      field(hex64(hash));
+    }
+    return key;
+  }
+  void setup_io(Stdio::Value mode,
+                Stdio::Value stdin_mode = Stdio::Value::Inherit) {
     if (not io_stdin) {
-      io_stdin = Stdio::inherit(); // FIX:
+      io_stdin = Stdio(stdin_mode);
     }
     if (not io_stdout) {
       io_stdout = Stdio(mode);
@@ -360,29 +2329,259 @@ public:
       io_stderr = Stdio(mode);
     }
   }
-  Child spawn() {
-    auto arguments = build_args();
-    auto [our_stdin, their_stdin] = io_stdin->impl_->to_fds(0);
-    auto [our_stdout, their_stdout] = io_stdout->impl_->to_fds(1);
-    auto [our_stderr, their_stderr] = io_stderr->impl_->to_fds(2);
-    pid_t pid = fork();
-    if (pid == -1)
-      throw std::runtime_error("Failed to fork");
-    if (pid == 0) {
-      close(*our_stdin);
-      close(*our_stdout);
-      close(*our_stderr);
-      if (their_stdin.has_value() && their_stdin != STDIN_FILENO) {
-        dup2(*their_stdin, STDIN_FILENO);
-        close(*their_stdin);
-      }
-      if (their_stdout.has_value() && their_stdout != STDOUT_FILENO) {
-        dup2(*their_stdout, STDOUT_FILENO);
-        close(*their_stdout);
-      }
-      if (their_stderr.has_value() && their_stderr != STDERR_FILENO) {
-        dup2(*their_stderr, STDERR_FILENO);
-        close(*their_stderr);
+  // runs in the child between fork and exec
+  void apply_placement(int err_fd) {
+    if (affinity && sched_setaffinity(0, sizeof(cpu_set_t), &*affinity) == -1)
+      child_fail(err_fd, "failed to set cpu affinity");
+    if (mempolicy) {
+      auto &[mode, mask] = *mempolicy;
+      if (syscall(SYS_set_mempolicy, mode, mask.empty() ? nullptr : mask.data(),
+                  mask.size() * 8 * sizeof(unsigned long) + 1) == -1)
+        child_fail(err_fd, "failed to set memory policy");
+    }
+    if (scheduler) {
+      sched_param param{};
+      if (sched_setscheduler(0, *scheduler, &param) == -1)
+        child_fail(err_fd, "failed to set scheduling policy");
+    }
+    if (niceness) {
+      errno = 0;
+      if (::nice(*niceness) == -1 && errno != 0)
+        child_fail(err_fd, "failed to set nice value");
+    }
+    if (io_priority &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, *io_priority) == -1)
+      child_fail(err_fd, "failed to set io priority");
+  }
+  // runs in the child between fork and exec
+  void apply_tree_control(int err_fd, pid_t parent) {
+    if (new_sess && ::setsid() == -1)
+      child_fail(err_fd, "failed to create session");
+    if (new_group && not new_sess && setpgid(0, 0) == -1)
+      child_fail(err_fd, "failed to create process group");
+    if (death_signal) {
+      if (prctl(PR_SET_PDEATHSIG, *death_signal) == -1)
+        child_fail(err_fd, "failed to set parent death signal");
+      if (getppid() != parent) // parent already gone before prctl
+        _exit(127);
+    }
+  }
+  // what a spawn holds between preparing its fds and handing out the Child
+  struct Launch {
+    optional<int> ours[3];
+    optional<int> theirs[3];
+    int err_pipe[2] = {-1, -1};
+    optional<string> work_dir;
+    pid_t pid = -1;
+
+    // fds the child ends up with: (source, target) pairs covering stdio and
+    // the extra fds, applied in order. The child lifts each source above
+    // remap_floor into lifted first, so sized here rather than allocated
+    // after a vfork.
+    vector<pair<int, int>> remap;
+    vector<int> lifted;
+    int remap_floor = 0;
+    vector<pair<int, int>> extra_ours; // child fd, our end
+    vector<int> extra_theirs;          // child ends we created
+    vector<int> shm_rings;             // our ends that are shm channels
+    int notify_fd = -1;                // our notify socket
+    vector<pair<string, string>> env;  // set for this spawn only
+
+    void close_theirs() {
+      for (int id = 0; id < 3; id += 1) {
+        if (theirs[id] && *theirs[id] != id)
+          close(*theirs[id]);
+        theirs[id].reset();
+      }
+      for (int fd : extra_theirs)
+        close(fd);
+      extra_theirs.clear();
+    }
+    void close_all() {
+      close_theirs();
+      for (auto &fd : ours)
+        if (fd)
+          close(*std::exchange(fd, std::nullopt));
+      for (auto &[child_fd, fd] : extra_ours)
+        close(fd);
+      extra_ours.clear();
+      if (notify_fd >= 0)
+        close(std::exchange(notify_fd, -1));
+      for (int &fd : err_pipe)
+        if (fd >= 0)
+          close(std::exchange(fd, -1));
+    }
+  };
+  // executable and environment resolved in the parent, shareable between
+  // commands with the same program and environment settings
+  struct ExecImage {
+    string path; // empty: leave the PATH lookup to execvpe
+    vector<string> env;
+    vector<char *> envp;
+  };
+
+  // runs in the child: every source, identity mappings included, is first
+  // lifted to a close-on-exec copy above all targets, so no dup2 can replace
+  // a source that is still waiting to be moved; swaps, longer cycles and
+  // repeated targets (the last one wins) need no special casing
+  static void apply_remap(Launch &launch, int err_fd) {
+    for (size_t i = 0; i < launch.remap.size(); i += 1) {
+      int source = launch.remap[i].first;
+      if ((launch.lifted[i] = fcntl(source, F_DUPFD_CLOEXEC, launch.remap_floor)) == -1)
+        child_fail(err_fd, "failed to duplicate fd");
+    }
+    for (size_t i = 0; i < launch.remap.size(); i += 1)
+      if (dup2(launch.lifted[i], launch.remap[i].second) == -1)
+        child_fail(err_fd, "failed to duplicate fd");
+  }
+  void prepare(Launch &launch) {
+    build_args();
+    launch.work_dir = resolve_cwd();
+    try {
+      Stdio *ios[3] = {&*io_stdin, &*io_stdout, &*io_stderr};
+      for (uint8_t id = 0; id < 3; id += 1) {
+        auto [ours, theirs] = ios[id]->impl_->to_fds(id);
+        launch.ours[id] = ours;
+        launch.theirs[id] = theirs;
+        if (ios[id]->impl_->value == Stdio::Value::ShmChannel)
+          launch.shm_rings.push_back(*ours);
+        if (theirs && *theirs != id)
+          launch.remap.push_back({*theirs, id});
+      }
+      for (auto &extra : extra_fds) {
+        int source = extra.parent_fd;
+        if (extra.io) {
+          auto [ours, theirs] = extra.io->impl_->to_fds(extra.child_reads ? 0 : 1);
+          if (ours)
+            launch.extra_ours.push_back({extra.child_fd, *ours});
+          if (extra.io->impl_->value == Stdio::Value::ShmChannel)
+            launch.shm_rings.push_back(*ours);
+          if (theirs && *theirs > STDERR_FILENO)
+            launch.extra_theirs.push_back(*theirs);
+          if (not theirs)
+            continue;
+          source = *theirs;
+        }
+        launch.remap.push_back({source, extra.child_fd});
+      }
+      for (auto &[source, target] : launch.remap)
+        launch.remap_floor = std::max(launch.remap_floor, target + 1);
+      launch.lifted.resize(launch.remap.size());
+      if (notify_watchdog) {
+        string address;
+        launch.notify_fd = open_notify_socket(address);
+        launch.env.push_back({"NOTIFY_SOCKET", std::move(address)});
+        if (notify_watchdog->count() > 0)
+          launch.env.push_back(
+              {"WATCHDOG_USEC", std::to_string(notify_watchdog->count())});
+      }
+      // the child reports pre-exec failures through this close-on-exec pipe
+      if (::pipe2(launch.err_pipe, O_CLOEXEC) == -1)
+        throw std::runtime_error("Failed to create pipe");
+      // keep its write end clear of every fd the child is given
+      if (launch.err_pipe[1] < launch.remap_floor) {
+        int lifted = fcntl(launch.err_pipe[1], F_DUPFD_CLOEXEC, launch.remap_floor);
+        if (lifted == -1)
+          throw std::runtime_error("Failed to duplicate pipe");
+        close(std::exchange(launch.err_pipe[1], lifted));
+      }
+    } catch (...) {
+      launch.close_all();
+      throw;
+    }
+  }
+  string image_key() const {
+    string key = app;
+    key.push_back(inherit_env ? '\1' : '\0');
+    if (cwd) // relative PATH entries resolve from there
+      key += "\1" + *cwd;
+    for (const auto &[k, v] : envs) {
+      key.push_back('\0');
+      key += k;
+      key.push_back('=');
+      key += v;
+    }
+    return key;
+  }
+  ExecImage resolve_image() const {
+    ExecImage image;
+    if (inherit_env) {
+      for (char **var = environ; var && *var; var += 1)
+        image.env.emplace_back(*var);
+    }
+    for (const auto &[key, value] : envs) {
+      string entry = key + "=" + value;
+      auto same_key = [&](const string &var) {
+        return var.size() > key.size() && var.compare(0, key.size(), key) == 0 &&
+               var[key.size()] == '=';
+      };
+      auto it = std::find_if(image.env.begin(), image.env.end(), same_key);
+      if (it != image.env.end())
+        *it = std::move(entry);
+      else
+        image.env.push_back(std::move(entry));
+    }
+    for (auto &var : image.env)
+      image.envp.push_back(var.data());
+    image.envp.push_back(nullptr);
+
+    if (app.find('/') != string::npos) {
+      image.path = app;
+      return image;
+    }
+    string search = "/bin:/usr/bin";
+    for (auto &var : image.env)
+      if (var.compare(0, 5, "PATH=") == 0)
+        search = var.substr(5);
+    // the child changes directory before it execs
+    optional<string> work_dir = resolve_cwd();
+    for (size_t pos = 0; pos <= search.size();) {
+      size_t end = search.find(':', pos);
+      if (end == string::npos)
+        end = search.size();
+      string dir = search.substr(pos, end - pos);
+      string candidate = (dir.empty() ? string(".") : dir) + "/" + app;
+      string probe = candidate.front() != '/' && work_dir
+                         ? *work_dir + "/" + candidate
+                         : candidate;
+      if (access(probe.c_str(), X_OK) == 0) {
+        image.path = std::move(candidate);
+        break;
+      }
+      pos = end + 1;
+    }
+    return image;
+  }
+  // With a pre-resolved image the child only makes syscalls before exec, so
+  // it can share our memory (clone_vfork) instead of copying the page
+  // tables. Signals stay blocked across the spawn so no handler of ours
+  // runs in the child; it resets caught signals to their defaults before
+  // unmasking.
+  void fork_exec(Launch &launch, const ExecImage *image) {
+    pid_t parent = getpid();
+    sigset_t all_signals, old_mask;
+    auto in_child = [&] {
+      int err_fd = launch.err_pipe[1];
+      if (image) {
+        reset_signal_handlers();
+        pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+      }
+      apply_tree_control(err_fd, parent);
+      for (int id = 0; id < 3; id += 1) {
+        if (launch.ours[id])
+          close(*launch.ours[id]);
+      }
+      for (auto &[child_fd, fd] : launch.extra_ours)
+        close(fd);
+      apply_remap(launch, err_fd);
+      if (launch.work_dir && chdir(launch.work_dir->c_str()) == -1) {
+        child_fail(err_fd, "failed to change directory");
+      }
+      apply_placement(err_fd);
+      if (image) {
+        const char *path = image->path.empty() ? app.c_str() : image->path.c_str();
+        execvpe(path, exec_args.data(), image->envp.data());
+        child_fail(err_fd, "execvpe failed");
       }
       if (not inherit_env) {
         environ = nullptr;
@@ -390,51 +2589,156 @@ public:
       for (const auto &[key, value] : envs) {
         setenv(key.c_str(), value.c_str(), 1);
       }
-      if (auto lpath = cwd) {
-        string &path = *lpath;
-        char *home = nullptr;
-        if (path.front() == '~') {
-          if (not(home = getenv("HOME"))) {
-            throw std::runtime_error("HOME environment variable not set");
-          }
-        }
-        if (chdir((home ? string(home) + path.substr(1) : path).c_str()) ==
-            -1) {
-          throw std::runtime_error("failed to change directory");
-        }
-      }
-      if (execvp(app.c_str(), arguments.data()) == -1) {
-        throw std::runtime_error("execvp failed");
-        _exit(EXIT_FAILURE);
+      for (const auto &[key, value] : launch.env) {
+        setenv(key.c_str(), value.c_str(), 1);
       }
+      execvp(app.c_str(), exec_args.data());
+      child_fail(err_fd, "execvp failed");
+    };
+    pid_t pid;
+    if (image) {
+      sigfillset(&all_signals);
+      pthread_sigmask(SIG_BLOCK, &all_signals, &old_mask);
+      pid = clone_vfork(in_child);
+      pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    } else if ((pid = fork()) == 0) {
+      in_child();
     }
-    if (their_stdin.has_value() && *their_stdin != STDIN_FILENO) {
-      close(*their_stdin);
+    if (pid == -1) {
+      launch.close_all();
+      throw std::runtime_error("Failed to fork");
     }
-    if (their_stdout.has_value() && *their_stdout != STDOUT_FILENO) {
-      close(*their_stdout);
+    launch.pid = pid;
+    close(std::exchange(launch.err_pipe[1], -1));
+    if (new_group && not new_sess) {
+      // also from the parent, so the group exists before spawn() returns
+      setpgid(pid, pid);
     }
-    if (their_stderr.has_value() && *their_stderr != STDERR_FILENO) {
-      close(*their_stderr);
+    launch.close_theirs();
+  }
+  Child finish(Launch &launch) {
+    if (optional<string> failure = exec_failure(launch.err_pipe[0])) {
+      waitpid(launch.pid, nullptr, 0);
+      launch.close_all();
+      throw std::runtime_error(*failure);
     }
+    close(std::exchange(launch.err_pipe[0], -1));
 
     Child s;
-    if (our_stdin.has_value()) {
-      s.io_stdin = std::make_optional<ChildStdin>();
-      s.io_stdin->impl_ = std::make_unique<ChildStdin::Impl>(*our_stdin);
+    if (launch.ours[0].has_value()) {
+      s.io_stdin.emplace();
+      s.io_stdin->impl_->fd = *launch.ours[0];
+    }
+    if (launch.ours[1].has_value()) {
+      s.io_stdout.emplace();
+      s.io_stdout->impl_->fd = *launch.ours[1];
     }
-    if (our_stdout.has_value()) {
-      s.io_stdout = std::make_optional<ChildStdout>();
-      s.io_stdout->impl_ = std::make_unique<ChildStdout::Impl>(*our_stdout);
+    if (launch.ours[2].has_value()) {
+      s.io_stderr.emplace();
+      s.io_stderr->impl_->fd = *launch.ours[2];
     }
-    if (our_stderr.has_value()) {
-      s.io_stderr = std::make_optional<ChildStderr>();
-      s.io_stderr->impl_ = std::make_unique<ChildStderr::Impl>(*our_stderr);
+
+    for (int ring : launch.shm_rings)
+      process::shm::set_child(ring, launch.pid);
+
+    for (auto &[child_fd, fd] : launch.extra_ours)
+      s.impl_->extra_ends.emplace_back(child_fd, OwnedFd(fd));
+    launch.extra_ours.clear();
+
+    if (launch.notify_fd >= 0) {
+      s.impl_->notify = std::make_unique<NotifyState>();
+      s.impl_->notify->socket = OwnedFd(std::exchange(launch.notify_fd, -1));
+      s.impl_->notify->watchdog = *notify_watchdog;
     }
 
-    s.impl_ = std::make_unique<Child::Impl>(Process{.pid = pid});
+    s.impl_->start(launch.pid);
+    s.impl_->group_leader = new_group || new_sess;
     return s;
   }
+  Child spawn() {
+    std::shared_ptr<Backend> backend = Backend::installed();
+    if (not backend)
+      return spawn_direct();
+    SpawnRequest request;
+    build_args();
+    request.argv.assign(exec_args.begin(), exec_args.end() - 1);
+    request.cwd = resolve_cwd();
+    Stdio *ios[3] = {&*io_stdin, &*io_stdout, &*io_stderr};
+    for (int id = 0; id < 3; id += 1)
+      request.piped[id] = ios[id]->impl_->value == Stdio::Value::NewPipe;
+    request.command_ = this;
+    return backend->spawn(request);
+  }
+  // spawn with extra arguments after our own, which are dropped again
+  Child spawn_with(span<const std::string_view> extra) {
+    size_t block_size = arg_block.size(), count = arg_count;
+    auto restore = [&] {
+      arg_block.resize(block_size);
+      arg_count = count;
+    };
+    try {
+      for (std::string_view arg : extra)
+        add_args(arg);
+      Child child = spawn();
+      restore();
+      return child;
+    } catch (...) {
+      restore();
+      throw;
+    }
+  }
+  // Bytes execve copies for this command: the path, every argv and
+  // environment string with its NUL, and both pointer arrays. The model
+  // for_each_batch packs arguments against.
+  size_t exec_size() const {
+    ExecImage image = resolve_image();
+    size_t size = (image.path.empty() ? app.size() : image.path.size()) + 1;
+    size += app.size() + 1 + arg_block.size() + (arg_count + 2) * sizeof(char *);
+    for (const string &var : image.env)
+      size += var.size() + 1 + sizeof(char *);
+    return size + sizeof(char *);
+  }
+  Child spawn_direct() {
+    Launch launch;
+    prepare(launch);
+    fork_exec(launch, nullptr);
+    return finish(launch);
+  }
+  // spawn with stdin fed from next_input while stdout/stderr are drained
+  Output spawn_fed(const std::function<span<const std::byte>()> &next_input) {
+    if (io_stdin->impl_->value != Stdio::Value::NewPipe)
+      throw std::runtime_error("stdin of the child is not piped");
+    Child child = spawn();
+    Output output;
+    int in_fd = child.io_stdin->impl_->fd;
+    int out_fd = child.io_stdout ? child.io_stdout->impl_->fd : -1;
+    int err_fd = child.io_stderr ? child.io_stderr->impl_->fd : -1;
+    FileDesc::Capture out{&output.std_out, spill_limit.value_or(SIZE_MAX), spill_dir};
+    FileDesc::Capture err{&output.std_err, spill_limit.value_or(SIZE_MAX), spill_dir};
+    // the child handle keeps owning stdin: it is closed here once the input
+    // ends, and by the handle if feeding or draining fails
+    auto input_done = [&] {
+      child.io_stdin.reset();
+      return false;
+    };
+    try {
+      FileDesc::communicate(in_fd, next_input, out_fd, out, err_fd, err,
+                            input_done);
+    } catch (...) {
+      try {
+        child.kill();
+        child.wait();
+      } catch (...) {
+      }
+      throw;
+    }
+    if (out.spill >= 0)
+      output.std_out_file = SpillFile(out.take_spill());
+    if (err.spill >= 0)
+      output.std_err_file = SpillFile(err.take_spill());
+    output.status = child.wait();
+    return output;
+  }
 };
 
 Command::Command(const string &app) : impl_(std::make_unique<Impl>()) {
@@ -450,12 +2754,12 @@ Command &Command::operator=(Command &&other) {
   return *this;
 }
 
-Command &&Command::arg(const string &arg) {
+Command &&Command::arg(std::string_view arg) {
   impl_->add_args(arg);
   return std::move(*this);
 }
-Command &&Command::args(const std::vector<std::string> &args) {
-  for (const auto &arg : args) {
+Command &&Command::args(std::initializer_list<std::string_view> args) {
+  for (auto arg : args) {
     impl_->add_args(arg);
   }
   return std::move(*this);
@@ -484,6 +2788,126 @@ Command &&Command::env_clear() {
   impl_->clear_env();
   return std::move(*this);
 }
+Command &&Command::cpu_affinity(const vector<int> &cpus) {
+  impl_->set_affinity(cpus);
+  return std::move(*this);
+}
+Command &&Command::mem_policy(MemPolicy policy, const vector<int> &nodes) {
+  impl_->set_mempolicy(policy, nodes);
+  return std::move(*this);
+}
+Command &&Command::nice(int increment) {
+  impl_->set_nice(increment);
+  return std::move(*this);
+}
+Command &&Command::sched_policy(SchedPolicy policy) {
+  impl_->set_scheduler(policy);
+  return std::move(*this);
+}
+Command &&Command::ioprio(IoPriority io_class, int level) {
+  impl_->set_ioprio(io_class, level);
+  return std::move(*this);
+}
+Command &&Command::process_group(bool enable) {
+  impl_->set_process_group(enable);
+  return std::move(*this);
+}
+Command &&Command::new_session(bool enable) {
+  impl_->set_session(enable);
+  return std::move(*this);
+}
+Command &&Command::parent_death_signal(int signal) {
+  impl_->set_death_signal(signal);
+  return std::move(*this);
+}
+Command &&Command::cache(OutputCache &cache) {
+  impl_->set_cache(cache);
+  return std::move(*this);
+}
+Command &&Command::cache_env(std::string_view key) {
+  impl_->add_cache_env(key);
+  return std::move(*this);
+}
+Command &&Command::cache_input(std::string_view path) {
+  impl_->add_cache_input(path);
+  return std::move(*this);
+}
+Command &&Command::spill_threshold(size_t bytes, const string &directory) {
+  impl_->set_spill(bytes, directory);
+  return std::move(*this);
+}
+Command &&Command::pass_fd(int parent_fd, int child_fd) {
+  impl_->add_extra_fd({.child_fd = child_fd, .parent_fd = parent_fd});
+  return std::move(*this);
+}
+Command &&Command::extra_in(int child_fd, Stdio io) {
+  impl_->add_extra_fd(
+      {.child_fd = child_fd, .child_reads = true, .io = std::move(io)});
+  return std::move(*this);
+}
+Command &&Command::extra_out(int child_fd, Stdio io) {
+  impl_->add_extra_fd({.child_fd = child_fd, .io = std::move(io)});
+  return std::move(*this);
+}
+Command &&Command::notify_socket(std::chrono::microseconds watchdog) {
+  impl_->set_notify(watchdog);
+  return std::move(*this);
+}
+Child Command::spawn_argv(const char *const *argv, bool capture) {
+  int err_pipe[2], out[2] = {-1, -1}, err[2] = {-1, -1};
+  auto close_fds = [](std::initializer_list<int> fds) {
+    for (int fd : fds)
+      if (fd >= 0)
+        close(fd);
+  };
+  if (::pipe2(err_pipe, O_CLOEXEC) == -1)
+    throw std::runtime_error("Failed to create pipe");
+  if (capture && (::pipe2(out, O_CLOEXEC) == -1 || ::pipe2(err, O_CLOEXEC) == -1)) {
+    close_fds({err_pipe[0], err_pipe[1], out[0], out[1]});
+    throw std::runtime_error("Failed to create pipe");
+  }
+  // same discipline as the resolved-image path of fork_exec
+  sigset_t all_signals, old_mask;
+  auto in_child = [&] {
+    reset_signal_handlers();
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    if (capture && (dup2(out[1], STDOUT_FILENO) == -1 ||
+                    dup2(err[1], STDERR_FILENO) == -1))
+      child_fail(err_pipe[1], "failed to duplicate fd");
+    execvp(argv[0], const_cast<char *const *>(argv));
+    child_fail(err_pipe[1], "execvp failed");
+  };
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_BLOCK, &all_signals, &old_mask);
+  pid_t pid = clone_vfork(in_child);
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+  close_fds({err_pipe[1], out[1], err[1]});
+  if (pid == -1) {
+    close_fds({err_pipe[0], out[0], err[0]});
+    throw std::runtime_error("Failed to fork");
+  }
+  optional<string> failure = exec_failure(err_pipe[0]);
+  close(err_pipe[0]);
+  if (failure) {
+    waitpid(pid, nullptr, 0);
+    close_fds({out[0], err[0]});
+    throw std::runtime_error(*failure);
+  }
+
+  Child child;
+  if (capture) {
+    child.io_stdout.emplace();
+    child.io_stdout->impl_->fd = out[0];
+    child.io_stderr.emplace();
+    child.io_stderr->impl_->fd = err[0];
+  }
+  child.impl_->start(pid);
+  return child;
+}
+Child Command::spawn_captured() {
+  impl_->setup_io(Stdio::Value::NewPipe);
+  return impl_->spawn();
+}
 Child Command::spawn() {
   impl_->setup_io(Stdio::Value::Inherit);
   return impl_->spawn();
@@ -495,10 +2919,1271 @@ ExitStatus Command::status() {
 }
 
 Output Command::output() {
+  OutputCache *cache = impl_->cache();
+  string key;
+  if (cache) {
+    key = impl_->cache_key();
+    if (auto hit = cache->lookup(key))
+      return std::move(*hit);
+  }
   impl_->setup_io(Stdio::Value::NewPipe);
   Child child = impl_->spawn();
-  return child.wait_with_output();
+  Output output = impl_->spill()
+                      ? child.wait_with_output(*impl_->spill(),
+                                               impl_->spill_directory())
+                      : child.wait_with_output();
+  // a signalled run says nothing about the command itself, and spilled
+  // output is too large to be worth keeping
+  if (cache && output.status.code() && not output.std_out_file &&
+      not output.std_err_file)
+    cache->store(key, output);
+  return output;
+}
+
+Output Command::output_with_input(span<const std::byte> input) {
+  impl_->setup_io(Stdio::Value::NewPipe, Stdio::Value::NewPipe);
+  bool sent = false;
+  return impl_->spawn_fed([&]() {
+    return std::exchange(sent, true) ? span<const std::byte>{} : input;
+  });
+}
+
+Output Command::output_with_input(
+    const std::function<size_t(span<std::byte>)> &source) {
+  impl_->setup_io(Stdio::Value::NewPipe, Stdio::Value::NewPipe);
+  vector<std::byte> chunk(64 * 1024);
+  return impl_->spawn_fed([&]() {
+    return span<const std::byte>(chunk.data(), source(chunk));
+  });
+}
+
+/*============================================================================*/
+vector<Child> spawn_many(span<Command> commands) {
+  using Impl = Command::Impl;
+  // Commands go out in windows: every fd held open while forking is copied
+  // into each child and closed again at its exec, so preparing the whole
+  // batch at once would make each spawn cost grow with the batch size.
+  constexpr size_t window = 16;
+  std::unordered_map<string, Impl::ExecImage> images;
+  vector<Child> children;
+  children.reserve(commands.size());
+  std::exception_ptr error;
+
+  for (size_t base = 0; base < commands.size() && not error; base += window) {
+    auto batch = commands.subspan(base, std::min(window, commands.size() - base));
+    Impl::Launch launches[window];
+    const Impl::ExecImage *image_of[window];
+    size_t prepared = 0, forked = 0;
+    try {
+      for (; prepared < batch.size(); prepared += 1) {
+        Impl &impl = *batch[prepared].impl_;
+        impl.setup_io(Stdio::Value::Inherit);
+        auto key = impl.image_key();
+        auto it = images.find(key);
+        if (it == images.end())
+          it = images.emplace(std::move(key), impl.resolve_image()).first;
+        // a per-spawn environment (the notify socket) takes the fork path
+        image_of[prepared] = impl.notifies() ? nullptr : &it->second;
+        impl.prepare(launches[prepared]);
+      }
+      for (; forked < batch.size(); forked += 1)
+        batch[forked].impl_->fork_exec(launches[forked], image_of[forked]);
+    } catch (...) {
+      error = std::current_exception();
+      for (size_t i = forked; i < prepared; i += 1)
+        launches[i].close_all();
+    }
+    for (size_t i = 0; i < forked; i += 1) {
+      try {
+        children.push_back(batch[i].impl_->finish(launches[i]));
+      } catch (...) {
+        if (not error)
+          error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    // all or nothing: do not leave the caller with a partial batch
+    for (auto &child : children) {
+      child.kill();
+      child.wait();
+    }
+    std::rethrow_exception(error);
+  }
+  return children;
+}
+
+vector<Output> for_each_batch(Command command, span<const std::string_view> args,
+                              BatchOptions options) {
+  Command::Impl &impl = *command.impl_;
+  impl.setup_io(Stdio::Value::NewPipe);
+
+  // cut args into batches, each as large as the limits allow
+  size_t limit = options.max_bytes;
+  if (limit == 0)
+    limit = static_cast<size_t>(sysconf(_SC_ARG_MAX)) - 2048;
+  size_t base = impl.exec_size();
+  size_t max_string = 32 * static_cast<size_t>(sysconf(_SC_PAGESIZE)); // MAX_ARG_STRLEN
+  vector<span<const std::string_view>> batches;
+  for (size_t first = 0, end = 0; first < args.size(); first = end) {
+    size_t size = base;
+    for (end = first; end < args.size(); end += 1) {
+      size_t cost = args[end].size() + 1 + sizeof(char *);
+      if (options.max_args && end - first == options.max_args)
+        break;
+      if (size + cost > limit && end > first)
+        break;
+      if (args[end].size() >= max_string || size + cost > limit)
+        throw std::runtime_error("argument too long for a single invocation: " +
+                                 string(args[end].substr(0, 64)));
+      size += cost;
+    }
+    batches.push_back(args.subspan(first, end - first));
+  }
+
+  // run them with at most parallelism at once, one waiting thread each
+  size_t parallelism = options.parallelism ? options.parallelism : detail::cpu_count();
+  vector<Output> outputs(batches.size());
+  vector<std::thread> slots(std::min(parallelism, batches.size()));
+  vector<size_t> free_slots;
+  for (size_t slot = slots.size(); slot > 0; slot -= 1)
+    free_slots.push_back(slot - 1);
+  std::mutex mutex;
+  std::condition_variable slot_freed;
+  std::exception_ptr error;
+  for (size_t batch = 0; batch < batches.size(); batch += 1) {
+    size_t slot;
+    {
+      std::unique_lock lock(mutex);
+      slot_freed.wait(lock, [&] { return not free_slots.empty(); });
+      slot = free_slots.back();
+      free_slots.pop_back();
+      if (error)
+        break;
+    }
+    if (slots[slot].joinable())
+      slots[slot].join();
+    optional<Child> child;
+    try {
+      child.emplace(impl.spawn_with(batches[batch]));
+    } catch (...) {
+      std::lock_guard lock(mutex);
+      error = std::current_exception();
+      break;
+    }
+    slots[slot] = std::thread([&, batch, slot, child = std::move(*child)]() mutable {
+      Output output;
+      std::exception_ptr failure;
+      try {
+        output = child.wait_with_output();
+      } catch (...) {
+        failure = std::current_exception();
+      }
+      std::lock_guard lock(mutex);
+      outputs[batch] = std::move(output);
+      if (failure && not error)
+        error = failure;
+      free_slots.push_back(slot);
+      slot_freed.notify_one();
+    });
+  }
+  for (std::thread &thread : slots)
+    if (thread.joinable())
+      thread.join();
+  if (error)
+    std::rethrow_exception(error);
+  return outputs;
+}
+
+/*============================================================================*/
+void set_child_subreaper(bool enable) {
+  if (prctl(PR_SET_CHILD_SUBREAPER, enable ? 1 : 0) == -1)
+    throw std::runtime_error("failed to set child subreaper");
+}
+
+vector<int> numa_nodes() {
+  std::ifstream file("/sys/devices/system/node/online");
+  string text;
+  if (not file or not std::getline(file, text))
+    return {0};
+  auto nodes = parse_id_list(text);
+  return nodes.empty() ? vector<int>{0} : nodes;
+}
+
+vector<int> numa_node_cpus(int node) {
+  std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) +
+                     "/cpulist");
+  string text;
+  if (file and std::getline(file, text))
+    return parse_id_list(text);
+  // no topology exposed: every online cpu belongs to the single node
+  vector<int> cpus;
+  for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN); cpu += 1)
+    cpus.push_back(static_cast<int>(cpu));
+  return cpus;
+}
+
+NumaSpread::NumaSpread() : NumaSpread(numa_nodes()) {}
+NumaSpread::NumaSpread(vector<int> nodes) : nodes_(std::move(nodes)), next_(0) {
+  if (nodes_.empty())
+    throw std::runtime_error("NumaSpread needs at least one node");
+  for (int node : nodes_)
+    cpus_.push_back(numa_node_cpus(node));
+}
+Command &&NumaSpread::place(Command &&cmd) {
+  size_t slot = next_.fetch_add(1, std::memory_order_relaxed) % nodes_.size();
+  if (not cpus_[slot].empty())
+    cmd.cpu_affinity(cpus_[slot]);
+  return cmd.mem_policy(MemPolicy::Bind, {nodes_[slot]});
+}
+
+/*============================================================================*/
+struct WorkerPool::Impl {
+  struct Worker {
+    optional<Child> child;
+    string pending; // bytes read past the last response
+    size_t served = 0;
+  };
+  Command command;
+  Framing framing;
+  size_t max_requests;
+  vector<Worker> workers;
+  vector<size_t> idle;
+  std::mutex mutex;
+  std::condition_variable available;
+  std::mutex spawn_mutex; // guards the shared Command
+  std::atomic<size_t> respawned = 0;
+
+  Impl(Command cmd, size_t count, Framing framing, size_t max_requests)
+      : command(std::move(cmd)), framing(framing), max_requests(max_requests),
+        workers(count) {
+    if (count == 0)
+      throw std::runtime_error("WorkerPool needs at least one worker");
+    command.std_in(Stdio::pipe()).std_out(Stdio::pipe());
+    for (size_t id = 0; id < count; id += 1) {
+      start(workers[id]);
+      idle.push_back(id);
+    }
+  }
+  // how long a worker gets to exit once its stdin is closed
+  static constexpr std::chrono::seconds stop_grace{1};
+
+  ~Impl() {
+    for (auto &worker : workers)
+      if (worker.child)
+        worker.child->io_stdin.reset(); // end of input asks every worker to exit
+    auto deadline = std::chrono::steady_clock::now() + stop_grace;
+    for (auto &worker : workers)
+      stop(worker, deadline);
+  }
+
+  void start(Worker &worker) {
+    std::lock_guard lock(spawn_mutex);
+    worker.child = command.spawn();
+    worker.pending.clear();
+    worker.served = 0;
+  }
+  // Close the worker's stdin and give it until deadline to exit, then kill
+  // it. Never throws: it runs on failure paths, where the worker may be
+  // gone already.
+  void stop(Worker &worker, std::chrono::steady_clock::time_point deadline) noexcept {
+    if (not worker.child)
+      return;
+    try {
+      worker.child->io_stdin.reset();
+      auto exit = worker.child->wait_async();
+      if (exit.wait_until(deadline) != std::future_status::ready)
+        worker.child->kill();
+      exit.wait();
+    } catch (...) {
+    }
+    worker.child.reset();
+  }
+
+  size_t acquire() {
+    std::unique_lock lock(mutex);
+    available.wait(lock, [&] { return not idle.empty(); });
+    size_t id = idle.back();
+    idle.pop_back();
+    return id;
+  }
+  void release(size_t id) {
+    {
+      std::lock_guard lock(mutex);
+      idle.push_back(id);
+    }
+    available.notify_one();
+  }
+
+  // bytes of pending up to the end of the first complete response, 0 while
+  // it is still incomplete
+  size_t response_end(const string &pending) const {
+    if (framing == Framing::Line) {
+      size_t end = pending.find('\n');
+      return end == string::npos ? 0 : end + 1;
+    }
+    if (pending.size() < 4)
+      return 0;
+    size_t len = 0;
+    for (int i = 0; i < 4; i += 1)
+      len = len << 8 | static_cast<unsigned char>(pending[i]);
+    return pending.size() < 4 + len ? 0 : 4 + len;
+  }
+  // Send the request while reading the response from one poll loop, so a
+  // worker that answers while still reading a large request cannot block
+  // on its stdout as we block on its stdin.
+  string exchange(Worker &worker, std::string_view payload) {
+    char prefix[4];
+    span<const std::byte> parts[2];
+    if (framing == Framing::Line) {
+      parts[0] = std::as_bytes(span{payload});
+      parts[1] = std::as_bytes(span{"\n", 1});
+    } else {
+      uint32_t len = static_cast<uint32_t>(payload.size());
+      for (int i = 0; i < 4; i += 1)
+        prefix[i] = static_cast<char>(len >> (24 - 8 * i));
+      parts[0] = std::as_bytes(span{prefix});
+      parts[1] = std::as_bytes(span{payload});
+    }
+    size_t next = 0;
+    auto next_input = [&] {
+      while (next < 2 && parts[next].empty())
+        next += 1;
+      return next < 2 ? parts[next++] : span<const std::byte>{};
+    };
+    FileDesc::Capture out{&worker.pending}, err;
+    FileDesc::communicate(worker.child->io_stdin->native_handle(), next_input,
+                          worker.child->io_stdout->native_handle(), out, -1, err,
+                          [&] { return response_end(worker.pending) > 0; });
+    size_t end = response_end(worker.pending);
+    if (end == 0)
+      throw std::runtime_error("worker exited before responding");
+    string reply = framing == Framing::Line ? worker.pending.substr(0, end - 1)
+                                            : worker.pending.substr(4, end - 4);
+    worker.pending.erase(0, end);
+    return reply;
+  }
+
+  string request(std::string_view payload) {
+    if (framing == Framing::Line && payload.find('\n') != std::string_view::npos)
+      throw std::runtime_error("line framed request contains a newline");
+    if (framing == Framing::LengthPrefixed && payload.size() > UINT32_MAX)
+      throw std::runtime_error("request too large for a length prefix");
+    size_t id = acquire();
+    // the slot goes back whatever happens below
+    struct Release {
+      Impl *pool;
+      size_t id;
+      ~Release() { pool->release(id); }
+    } release_slot{this, id};
+    Worker &worker = workers[id];
+    try {
+      if (not worker.child) { // a replacement that failed to start earlier
+        start(worker);
+        respawned += 1;
+      }
+      string reply = exchange(worker, payload);
+      worker.served += 1;
+      if (max_requests && worker.served >= max_requests) {
+        stop(worker, std::chrono::steady_clock::now() + stop_grace);
+        // the reply is already ours; a replacement that fails to start is
+        // retried, and its error reported, by the next request on this slot
+        try {
+          start(worker);
+          respawned += 1;
+        } catch (...) {
+        }
+      }
+      return reply;
+    } catch (...) {
+      stop(worker, std::chrono::steady_clock::now());
+      try {
+        start(worker);
+        respawned += 1;
+      } catch (...) { // retried by the next request on this slot
+      }
+      throw;
+    }
+  }
+};
+
+WorkerPool::WorkerPool(Command command, size_t workers, Framing framing,
+                       size_t max_requests)
+    : impl_(std::make_unique<Impl>(std::move(command), workers, framing,
+                                   max_requests)) {}
+WorkerPool::~WorkerPool() = default;
+WorkerPool::WorkerPool(WorkerPool &&other) = default;
+WorkerPool &WorkerPool::operator=(WorkerPool &&other) = default;
+string WorkerPool::request(std::string_view payload) {
+  return impl_->request(payload);
+}
+size_t WorkerPool::size() const { return impl_->workers.size(); }
+size_t WorkerPool::respawns() const { return impl_->respawned; }
+
+/*============================================================================*/
+struct Graph::Impl {
+  struct Entry {
+    Command command;
+    std::chrono::milliseconds cost;
+    vector<Node> dependents;
+    optional<Node> pipe_to;
+    optional<Node> pipe_from;
+  };
+  vector<Entry> nodes;
+
+  void check(Node node) const {
+    if (node >= nodes.size())
+      throw std::runtime_error("unknown graph node " + std::to_string(node));
+  }
+  Node add(Command command, std::chrono::milliseconds cost) {
+    nodes.push_back({std::move(command), cost, {}, {}, {}});
+    return nodes.size() - 1;
+  }
+  void depends(Node later, Node earlier) {
+    check(later);
+    check(earlier);
+    if (later == earlier)
+      throw std::runtime_error("a node cannot depend on itself");
+    nodes[earlier].dependents.push_back(later);
+  }
+  void pipe(Node from, Node to) {
+    check(from);
+    check(to);
+    if (from == to)
+      throw std::runtime_error("a node cannot pipe into itself");
+    if (nodes[from].pipe_to || nodes[to].pipe_from)
+      throw std::runtime_error("node is already piped");
+    nodes[from].pipe_to = to;
+    nodes[to].pipe_from = from;
+  }
+
+  // scheduling state of one run
+  // Children are awaited through wait_async, so that those of a backend
+  // and those the reaper collects are handled alike; a pidfd, where the
+  // child has one, wakes the loop when it exits.
+  struct Running {
+    Node node;
+    size_t unit;
+    Child child;
+    std::future<ExitStatus> exit;
+    OwnedFd pidfd;
+  };
+  vector<vector<Node>> units; // pipelines, listed from their head
+  vector<size_t> unit_of;
+  vector<vector<size_t>> unit_next;
+  vector<size_t> unit_waiting; // unfinished units it depends on
+  vector<size_t> unit_left;    // members still running
+  vector<char> unit_failed, unit_cancelled;
+  vector<long long> rank;      // cost of the longest chain it heads
+  vector<NodeResult> results;
+  vector<Running> running;
+  std::priority_queue<pair<long long, size_t>> ready;
+
+  void build_units() {
+    size_t count = nodes.size();
+    units.clear();
+    unit_of.assign(count, SIZE_MAX);
+    for (Node head = 0; head < count; head += 1) {
+      if (nodes[head].pipe_from)
+        continue;
+      units.emplace_back();
+      for (optional<Node> node = head; node; node = nodes[*node].pipe_to) {
+        unit_of[*node] = units.size() - 1;
+        units.back().push_back(*node);
+      }
+    }
+    if (std::find(unit_of.begin(), unit_of.end(), SIZE_MAX) != unit_of.end())
+      throw std::runtime_error("pipe connections form a cycle");
+
+    size_t unit_count = units.size();
+    unit_next.assign(unit_count, {});
+    unit_waiting.assign(unit_count, 0);
+    for (Node node = 0; node < count; node += 1) {
+      for (Node later : nodes[node].dependents) {
+        if (unit_of[later] == unit_of[node])
+          throw std::runtime_error("dependency between nodes of one pipeline");
+        unit_next[unit_of[node]].push_back(unit_of[later]);
+        unit_waiting[unit_of[later]] += 1;
+      }
+    }
+
+    // topological order, then ranks from the sinks back
+    vector<size_t> order, waiting = unit_waiting;
+    for (size_t unit = 0; unit < unit_count; unit += 1)
+      if (waiting[unit] == 0)
+        order.push_back(unit);
+    for (size_t i = 0; i < order.size(); i += 1)
+      for (size_t next : unit_next[order[i]])
+        if (--waiting[next] == 0)
+          order.push_back(next);
+    if (order.size() != unit_count)
+      throw std::runtime_error("dependencies form a cycle");
+    rank.assign(unit_count, 0);
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+      long long cost = 0, tail = 0;
+      for (Node node : units[*it]) // pipeline members run side by side
+        cost = std::max<long long>(cost, nodes[node].cost.count());
+      for (size_t next : unit_next[*it])
+        tail = std::max(tail, rank[next]);
+      rank[*it] = cost + tail;
+    }
+  }
+
+  void launch(size_t unit) {
+    unit_left[unit] = units[unit].size();
+    optional<ChildStdout> upstream;
+    bool broken = false; // a member failed to start
+    for (Node node : units[unit]) {
+      NodeResult &result = results[node];
+      if (broken) {
+        // without its upstream it would read our stdin instead
+        result.started = result.finished = std::chrono::steady_clock::now();
+        finish(node, unit, false);
+        continue;
+      }
+      Command &command = nodes[node].command;
+      bool fed = upstream.has_value();
+      if (fed) {
+        command.std_in(Stdio::from(std::move(*upstream)));
+        upstream.reset();
+      }
+      if (nodes[node].pipe_to)
+        command.std_out(Stdio::pipe());
+      result.started = std::chrono::steady_clock::now();
+      try {
+        Child child = command.spawn();
+        if (nodes[node].pipe_to) {
+          upstream = std::move(child.io_stdout);
+          child.io_stdout.reset();
+        }
+        auto exit = child.wait_async();
+        OwnedFd pidfd = child.impl_->open_pidfd();
+        running.push_back(
+            {node, unit, std::move(child), std::move(exit), std::move(pidfd)});
+      } catch (const std::exception &) {
+        if (fed) // let go of the pipe so the producer is not left blocked
+          command.std_in(Stdio::inherit());
+        result.finished = std::chrono::steady_clock::now();
+        finish(node, unit, false);
+        broken = true;
+      }
+    }
+    // the members already started fail with it
+    if (broken)
+      for (auto &entry : running)
+        if (entry.unit == unit)
+          entry.child.kill();
+  }
+
+  void finish(Node node, size_t unit, bool success) {
+    results[node].state = success ? NodeState::Succeeded : NodeState::Failed;
+    if (not success)
+      unit_failed[unit] = true;
+    if (--unit_left[unit] > 0)
+      return;
+    if (unit_failed[unit]) {
+      cancel_after(unit);
+      return;
+    }
+    for (size_t next : unit_next[unit])
+      if (--unit_waiting[next] == 0 && not unit_cancelled[next])
+        ready.push({rank[next], next});
+  }
+
+  void cancel_after(size_t unit) {
+    vector<size_t> stack = unit_next[unit];
+    while (not stack.empty()) {
+      size_t next = stack.back();
+      stack.pop_back();
+      if (unit_cancelled[next])
+        continue;
+      unit_cancelled[next] = true;
+      for (Node node : units[next])
+        results[node].state = NodeState::Cancelled;
+      stack.insert(stack.end(), unit_next[next].begin(), unit_next[next].end());
+    }
+  }
+
+  // block until at least one running child has exited, then collect them
+  void reap() {
+    vector<pollfd> fds;
+    bool unwatched = false;
+    for (auto &entry : running) {
+      fds.push_back({entry.pidfd.fd, POLLIN, 0});
+      unwatched |= entry.pidfd.fd < 0;
+    }
+    // without pidfds fall back to checking each child every few ms
+    if (::poll(fds.data(), fds.size(), unwatched ? 5 : -1) == -1 && errno != EINTR)
+      throw std::runtime_error("failed to poll running children");
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = running.size(); i-- > 0;) {
+      Running &entry = running[i];
+      // an exited child is about to be reaped, its status follows shortly
+      if (fds[i].revents != 0)
+        entry.exit.wait();
+      if (entry.exit.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        continue;
+      ExitStatus status = entry.exit.get();
+      results[entry.node].finished = now;
+      results[entry.node].exit_code = status.code();
+      Node node = entry.node;
+      size_t unit = entry.unit;
+      running.erase(running.begin() + i);
+      finish(node, unit, status.success());
+    }
+  }
+
+  vector<NodeResult> run(size_t parallelism) {
+    size_t limit = parallelism ? parallelism
+                               : std::max(1u, std::thread::hardware_concurrency());
+    build_units();
+    size_t unit_count = units.size();
+    unit_left.assign(unit_count, 0);
+    unit_failed.assign(unit_count, false);
+    unit_cancelled.assign(unit_count, false);
+    results.assign(nodes.size(), NodeResult{});
+    running.clear();
+    ready = {};
+    for (size_t unit = 0; unit < unit_count; unit += 1)
+      if (unit_waiting[unit] == 0)
+        ready.push({rank[unit], unit});
+
+    try {
+      while (not ready.empty() || not running.empty()) {
+        // a pipeline wider than the limit still runs, alone
+        while (not ready.empty() &&
+               (running.empty() ||
+                running.size() + units[ready.top().second].size() <= limit)) {
+          size_t unit = ready.top().second;
+          ready.pop();
+          launch(unit);
+        }
+        if (not running.empty())
+          reap();
+      }
+    } catch (...) {
+      for (auto &entry : running) {
+        entry.child.kill();
+        entry.exit.wait();
+      }
+      running.clear();
+      throw;
+    }
+    return std::move(results);
+  }
+};
+
+Graph::Graph() : impl_(std::make_unique<Impl>()) {}
+Graph::~Graph() = default;
+Graph::Graph(Graph &&other) = default;
+Graph &Graph::operator=(Graph &&other) = default;
+Graph::Node Graph::add(Command command, std::chrono::milliseconds cost) {
+  return impl_->add(std::move(command), cost);
+}
+void Graph::depends(Node later, Node earlier) { impl_->depends(later, earlier); }
+void Graph::pipe(Node from, Node to) { impl_->pipe(from, to); }
+vector<NodeResult> Graph::run(size_t parallelism) {
+  return impl_->run(parallelism);
 }
+/*============================================================================*/
+
+namespace detail {
+ForkedFn fork_fn(const vector<int> &cpus, void (*run)(void *, int),
+                 void *context) {
+  optional<cpu_set_t> affinity;
+  if (not cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+      if (cpu < 0 || cpu >= CPU_SETSIZE)
+        throw std::runtime_error("cpu id out of range: " + std::to_string(cpu));
+      CPU_SET(cpu, &set);
+    }
+    affinity = set;
+  }
+  int report[2];
+  if (pipe2(report, O_CLOEXEC) == -1)
+    throw std::runtime_error("failed to create spawn_fn pipe");
+  pid_t pid = fork();
+  if (pid == -1) {
+    ::close(report[0]);
+    ::close(report[1]);
+    throw std::runtime_error("failed to fork");
+  }
+  if (pid == 0) {
+    // Nothing may leave this branch: an exception would unwind into the
+    // caller's frames and go on running the parent's program in the child.
+    ::close(report[0]);
+    auto report_error = [&](const char *what) noexcept {
+      try {
+        write_report(report[1], 'E', std::as_bytes(span{what, strlen(what)}));
+      } catch (...) { // e.g. the parent closed the pipe; the status tells
+      }
+    };
+    int status = 0;
+    try {
+      if (affinity && sched_setaffinity(0, sizeof(cpu_set_t), &*affinity) == -1)
+        throw std::runtime_error(string("failed to set cpu affinity: ") +
+                                 strerror(errno));
+      run(context, report[1]);
+    } catch (const std::exception &e) {
+      status = 1;
+      report_error(e.what());
+    } catch (...) {
+      status = 1;
+      report_error("unknown exception");
+    }
+    // no atexit handlers or static destructors: they belong to the parent
+    _exit(status);
+  }
+  ::close(report[1]);
+  return {pid, report[0]};
+}
+
+void *map_shared(size_t size) {
+  void *region = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED)
+    throw std::runtime_error(string("failed to map spawn_fn result: ") +
+                             strerror(errno));
+  return region;
+}
+
+void unmap_shared(void *region, size_t size) { munmap(region, size); }
+
+void write_report(int fd, char tag, span<const std::byte> payload) {
+  iovec iovs[2] = {{&tag, 1},
+                   {const_cast<std::byte *>(payload.data()), payload.size()}};
+  FileDesc::writev_all(fd, iovs);
+}
+
+string read_report(int fd) {
+  OwnedFd owned{fd};
+  string report;
+  FileDesc::read_to_string(fd, report);
+  return report;
+}
+
+void close_fd(int fd) { ::close(fd); }
+
+optional<int> reap_fn(int pid, bool kill_first) {
+  if (kill_first)
+    ::kill(pid, SIGKILL);
+  return Process{pid}.wait();
+}
+
+size_t cpu_count() { return std::max(1u, std::thread::hardware_concurrency()); }
+} // namespace detail
+
+/*============================================================================*/
+namespace {
+std::mutex backend_mutex;
+std::shared_ptr<Backend> backend_installed;
+std::atomic<bool> backend_any{false}; // spares the lock when none is set
+} // namespace
+
+void Backend::install(std::shared_ptr<Backend> backend) {
+  std::lock_guard lock(backend_mutex);
+  backend_any = backend != nullptr;
+  backend_installed = std::move(backend);
+}
+std::shared_ptr<Backend> Backend::installed() {
+  if (not backend_any.load(std::memory_order_relaxed))
+    return nullptr;
+  std::lock_guard lock(backend_mutex);
+  return backend_installed;
+}
+Child Backend::spawn_unix(const SpawnRequest &request) {
+  return request.command_->spawn_direct();
+}
+Child Backend::adopt(int id, const int (&fds)[3], int pid) {
+  return Child::Impl::adopt(shared_from_this(), id, fds, pid);
+}
+void Backend::release_stdio(Child &child, int (&fds)[3]) {
+  Child::Impl::release_stdio(child, fds);
+}
+
+struct UnixBackend::Impl {
+  std::mutex mutex;
+  std::unordered_map<int, Child> children; // by pid
+};
+UnixBackend::UnixBackend() : impl_(std::make_unique<Impl>()) {}
+UnixBackend::~UnixBackend() = default;
+
+Child UnixBackend::adopt(Child real) {
+  int pid = real.id();
+  int fds[3];
+  release_stdio(real, fds);
+  {
+    std::lock_guard lock(impl_->mutex);
+    impl_->children.emplace(pid, std::move(real));
+  }
+  return Backend::adopt(pid, fds, pid);
+}
+optional<int> UnixBackend::wait(int id) {
+  optional<Child> real;
+  {
+    std::lock_guard lock(impl_->mutex);
+    auto found = impl_->children.find(id);
+    if (found == impl_->children.end())
+      throw std::runtime_error("no such child of this backend");
+    real.emplace(std::move(found->second));
+    impl_->children.erase(found);
+  }
+  // through the Child, so a running reaper and reused pids are accounted for
+  return real->wait().code();
+}
+void UnixBackend::kill(int id) {
+  std::lock_guard lock(impl_->mutex);
+  auto found = impl_->children.find(id);
+  if (found != impl_->children.end())
+    found->second.kill();
+}
+void UnixBackend::release(int id) {
+  optional<Child> real; // dropped outside the lock, like any unwaited child
+  std::lock_guard lock(impl_->mutex);
+  auto found = impl_->children.find(id);
+  if (found == impl_->children.end())
+    return;
+  real.emplace(std::move(found->second));
+  impl_->children.erase(found);
+}
+
+// Trace format: "PTRC", a version byte, then records of a kind byte, the
+// child id and the microseconds since recording began as LEB128 varints,
+// followed by
+//   Spawn: argc, then each argument as length and bytes
+//   Data:  stream byte (0 stdin, 1 stdout, 2 stderr), length and bytes
+//   Exit:  exit code + 1, or 0 when killed by a signal
+namespace trace {
+constexpr char magic[] = {'P', 'T', 'R', 'C', 1};
+enum Kind : uint8_t { Spawn = 1, Data = 2, Exit = 3 };
+
+void put_varint(string &out, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    out.push_back(static_cast<char>(byte | (value ? 0x80 : 0)));
+  } while (value);
+}
+
+struct Cursor {
+  const string &in;
+  size_t pos = 0;
+  bool done() const { return pos == in.size(); }
+  uint8_t byte() {
+    if (pos >= in.size())
+      throw std::runtime_error("truncated trace");
+    return static_cast<uint8_t>(in[pos++]);
+  }
+  uint64_t varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t next = byte();
+      value |= uint64_t(next & 0x7f) << shift;
+      if (not(next & 0x80))
+        return value;
+    }
+    throw std::runtime_error("corrupt trace");
+  }
+  string bytes() {
+    uint64_t length = varint();
+    if (length > in.size() - pos)
+      throw std::runtime_error("truncated trace");
+    pos += length;
+    return in.substr(pos - length, length);
+  }
+};
+} // namespace trace
+
+struct RecordingBackend::Impl {
+  std::mutex mutex;
+  FILE *file;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::shared_ptr<Backend> inner;
+  std::unordered_map<int, Child> children;
+  int next_id = 1;
+
+  Impl(const string &path, std::shared_ptr<Backend> inner)
+      : file(fopen(path.c_str(), "wb")), inner(std::move(inner)) {
+    if (not file)
+      throw std::runtime_error("failed to open trace " + path + ": " +
+                               strerror(errno));
+    fwrite(trace::magic, 1, sizeof(trace::magic), file);
+  }
+  ~Impl() { fclose(file); }
+
+  // one record; body is appended after the common fields
+  void record(trace::Kind kind, int id, const string &body) {
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    string head(1, static_cast<char>(kind));
+    trace::put_varint(head, id);
+    trace::put_varint(head, micros.count());
+    std::lock_guard lock(mutex);
+    fwrite(head.data(), 1, head.size(), file);
+    fwrite(body.data(), 1, body.size(), file);
+    // on disk as it happens: readers need not wait for the relays to end,
+    // and a crash keeps everything up to it
+    fflush(file);
+  }
+  void record_data(int id, uint8_t stream, span<const std::byte> chunk) {
+    string body(1, static_cast<char>(stream));
+    trace::put_varint(body, chunk.size());
+    body.append(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+    record(trace::Data, id, body);
+  }
+
+  // Relay one stream between the caller's pipe and the real child,
+  // recording every chunk on the way; keeps the recorder alive until the
+  // stream ends.
+  static void relay(std::shared_ptr<Impl> self, int id, uint8_t stream,
+                    int from, int to) {
+    std::byte chunk[64 * 1024];
+    while (size_t got = FileDesc::read(from, chunk)) {
+      self->record_data(id, stream, span{chunk, got});
+      iovec iov{chunk, got};
+      try {
+        FileDesc::writev_all(to, span{&iov, 1});
+      } catch (const std::exception &) {
+        break; // the reader is gone; the writer sees a broken pipe
+      }
+    }
+    // let go first, so a trace is complete once its readers see the end
+    self.reset();
+    ::close(from);
+    ::close(to);
+  }
+};
+
+RecordingBackend::RecordingBackend(const string &path,
+                                   std::shared_ptr<Backend> inner)
+    : impl_(std::make_shared<Impl>(path, std::move(inner))) {}
+RecordingBackend::~RecordingBackend() = default;
+
+Child RecordingBackend::spawn(const SpawnRequest &request) {
+  Child real = impl_->inner->spawn(request);
+  int pid = real.id();
+  int id;
+  {
+    std::lock_guard lock(impl_->mutex);
+    id = impl_->next_id++;
+  }
+  string body;
+  trace::put_varint(body, request.argv.size());
+  for (const string &arg : request.argv) {
+    trace::put_varint(body, arg.size());
+    body += arg;
+  }
+  impl_->record(trace::Spawn, id, body);
+
+  // hand out pipes of our own and relay each to the real child's handle
+  int fds[3] = {-1, -1, -1};
+  auto relay = [&](uint8_t stream, int real_fd) {
+    int ends[2];
+    if (::pipe2(ends, O_CLOEXEC) == -1)
+      throw std::runtime_error("Failed to create pipe");
+    fds[stream] = stream == 0 ? ends[1] : ends[0];
+    auto [from, to] = stream == 0 ? pair{ends[0], real_fd} : pair{real_fd, ends[1]};
+    std::thread(Impl::relay, impl_, id, stream, from, to).detach();
+  };
+  int real_fds[3];
+  release_stdio(real, real_fds);
+  for (uint8_t stream = 0; stream < 3; stream += 1)
+    if (real_fds[stream] >= 0)
+      relay(stream, real_fds[stream]);
+  {
+    std::lock_guard lock(impl_->mutex);
+    impl_->children.emplace(id, std::move(real));
+  }
+  return adopt(id, fds, pid);
+}
+
+optional<int> RecordingBackend::wait(int id) {
+  optional<Child> real;
+  {
+    std::lock_guard lock(impl_->mutex);
+    auto found = impl_->children.find(id);
+    if (found == impl_->children.end())
+      throw std::runtime_error("no such recorded child");
+    real.emplace(std::move(found->second));
+    impl_->children.erase(found);
+  }
+  optional<int> code = real->wait().code();
+  string body;
+  trace::put_varint(body, code ? *code + 1 : 0);
+  impl_->record(trace::Exit, id, body);
+  return code;
+}
+
+void RecordingBackend::kill(int id) {
+  std::lock_guard lock(impl_->mutex);
+  auto found = impl_->children.find(id);
+  if (found != impl_->children.end())
+    found->second.kill();
+}
+
+void RecordingBackend::release(int id) {
+  optional<Child> real; // dropped outside the lock; no exit is recorded
+  std::lock_guard lock(impl_->mutex);
+  auto found = impl_->children.find(id);
+  if (found == impl_->children.end())
+    return;
+  real.emplace(std::move(found->second));
+  impl_->children.erase(found);
+}
+
+struct ReplayBackend::Impl {
+  struct Chunk {
+    uint8_t stream;
+    std::chrono::microseconds at; // since the spawn
+    string bytes;
+  };
+  struct Run {
+    vector<Chunk> chunks;
+    std::chrono::microseconds exit_at{0};
+    optional<int> code;
+  };
+  // a run being played back
+  struct Playing {
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool killed = false;
+    bool done = false;
+    OwnedFd kill_event{eventfd(0, EFD_CLOEXEC)}; // also wakes blocked writes
+    optional<int> code;
+    std::thread player;
+  };
+
+  double speed;
+  std::mutex mutex;
+  std::unordered_map<string, std::deque<Run>> runs; // by argv joined with NULs
+  std::unordered_map<int, std::unique_ptr<Playing>> playing;
+  vector<std::unique_ptr<Playing>> released; // players nobody waits for
+  int next_id = 1;
+
+  static void stop(Playing &state) {
+    std::lock_guard lock(state.mutex);
+    state.killed = true;
+    state.wake.notify_all();
+    uint64_t one = 1;
+    ssize_t ignored = ::write(state.kill_event.fd, &one, sizeof(one));
+    (void)ignored;
+  }
+  // join the released players that have finished; called with mutex held
+  void reclaim() {
+    std::erase_if(released, [](std::unique_ptr<Playing> &state) {
+      {
+        std::lock_guard lock(state->mutex);
+        if (not state->done)
+          return false;
+      }
+      state->player.join();
+      return true;
+    });
+  }
+
+  static string key(const vector<string> &argv) {
+    string joined;
+    for (const string &arg : argv)
+      joined.append(arg).push_back('\0');
+    return joined;
+  }
+
+  Impl(const string &path, double speed) : speed(speed) {
+    std::ifstream file(path, std::ios::binary);
+    if (not file)
+      throw std::runtime_error("failed to open trace " + path);
+    string data{std::istreambuf_iterator<char>(file), {}};
+    if (data.compare(0, sizeof(trace::magic), trace::magic, sizeof(trace::magic)))
+      throw std::runtime_error(path + " is not a process trace");
+    trace::Cursor in{data, sizeof(trace::magic)};
+    struct Open {
+      string key;
+      std::chrono::microseconds spawned;
+      Run run;
+    };
+    std::unordered_map<uint64_t, Open> open;
+    vector<uint64_t> order; // spawn order, so runs of one argv replay in turn
+    std::unordered_map<uint64_t, Run> closed;
+    while (not in.done()) {
+      uint8_t kind = in.byte();
+      uint64_t id = in.varint();
+      std::chrono::microseconds at(in.varint());
+      if (kind == trace::Spawn) {
+        vector<string> argv(in.varint());
+        for (string &arg : argv)
+          arg = in.bytes();
+        open[id] = {key(argv), at, {}};
+        order.push_back(id);
+      } else if (kind == trace::Data) {
+        uint8_t stream = in.byte();
+        string bytes = in.bytes();
+        auto found = open.find(id);
+        if (found != open.end() && stream != 0)
+          found->second.run.chunks.push_back(
+              {stream, at - found->second.spawned, std::move(bytes)});
+      } else if (kind == trace::Exit) {
+        uint64_t code = in.varint();
+        auto found = open.find(id);
+        if (found == open.end())
+          continue;
+        Run &run = found->second.run;
+        run.exit_at = at - found->second.spawned;
+        if (code)
+          run.code = static_cast<int>(code - 1);
+      } else {
+        throw std::runtime_error("corrupt trace");
+      }
+    }
+    for (uint64_t id : order)
+      runs[open[id].key].push_back(std::move(open[id].run));
+  }
+
+  // sleep until at (scaled) past start; false when killed meanwhile
+  bool sleep_until(Playing &state, std::chrono::steady_clock::time_point start,
+                   std::chrono::microseconds at) {
+    std::unique_lock lock(state.mutex);
+    if (speed > 0) {
+      auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                             at / speed);
+      state.wake.wait_until(lock, due, [&] { return state.killed; });
+    }
+    return not state.killed;
+  }
+
+  // Write all of bytes to the non-blocking fd, waiting while the pipe is
+  // full; false when killed meanwhile or the reader is gone.
+  static bool deliver(Playing &state, int fd, const string &bytes) {
+    iovec iov{const_cast<char *>(bytes.data()), bytes.size()};
+    while (iov.iov_len > 0) {
+      ssize_t written = FileDesc::writev_nosigpipe(fd, &iov, 1);
+      if (written >= 0) {
+        iov.iov_base = static_cast<char *>(iov.iov_base) + written;
+        iov.iov_len -= written;
+        continue;
+      }
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN)
+        return false;
+      pollfd fds[2] = {{fd, POLLOUT, 0}, {state.kill_event.fd, POLLIN, 0}};
+      if (poll(fds, 2, -1) == -1 && errno != EINTR)
+        return false;
+      if (fds[1].revents)
+        return false;
+    }
+    return true;
+  }
+
+  void play(Playing &state, Run run, int out, int err) {
+    auto start = std::chrono::steady_clock::now();
+    bool finished = true;
+    for (int fd : {out, err})
+      if (fd >= 0)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    for (const Chunk &chunk : run.chunks) {
+      if (not sleep_until(state, start, chunk.at)) {
+        finished = false;
+        break;
+      }
+      int &fd = chunk.stream == 1 ? out : err;
+      if (fd >= 0 && not deliver(state, fd, chunk.bytes))
+        ::close(std::exchange(fd, -1)); // reader gone or killed: end of stream
+    }
+    for (int fd : {out, err})
+      if (fd >= 0)
+        ::close(fd);
+    if (finished)
+      finished = sleep_until(state, start, run.exit_at);
+    std::lock_guard lock(state.mutex);
+    state.code = finished ? run.code : std::nullopt;
+    state.done = true;
+  }
+};
+
+ReplayBackend::ReplayBackend(const string &path, double speed)
+    : impl_(std::make_unique<Impl>(path, speed)) {}
+ReplayBackend::~ReplayBackend() {
+  for (auto &[id, state] : impl_->playing)
+    impl_->released.push_back(std::move(state));
+  for (auto &state : impl_->released) {
+    Impl::stop(*state);
+    state->player.join();
+  }
+}
+
+Child ReplayBackend::spawn(const SpawnRequest &request) {
+  std::lock_guard lock(impl_->mutex);
+  auto found = impl_->runs.find(Impl::key(request.argv));
+  if (found == impl_->runs.end() || found->second.empty())
+    throw std::runtime_error("no recorded run left for " + request.argv[0]);
+  Impl::Run run = std::move(found->second.front());
+  found->second.pop_front();
+
+  int fds[3] = {-1, -1, -1}, theirs[3] = {-1, -1, -1};
+  for (int stream = 0; stream < 3; stream += 1) {
+    if (not request.piped[stream])
+      continue;
+    int ends[2];
+    if (::pipe2(ends, O_CLOEXEC) == -1)
+      throw std::runtime_error("Failed to create pipe");
+    fds[stream] = stream == 0 ? ends[1] : ends[0];
+    theirs[stream] = stream == 0 ? ends[0] : ends[1];
+  }
+  if (theirs[0] >= 0)
+    std::thread([in = theirs[0]] {
+      std::byte chunk[64 * 1024];
+      while (FileDesc::read(in, chunk)) {
+      }
+      ::close(in);
+    }).detach();
+  impl_->reclaim();
+  int id = impl_->next_id++;
+  auto state = std::make_unique<Impl::Playing>();
+  state->player = std::thread(&Impl::play, impl_.get(), std::ref(*state),
+                              std::move(run), theirs[1], theirs[2]);
+  impl_->playing.emplace(id, std::move(state));
+  return adopt(id, fds);
+}
+
+optional<int> ReplayBackend::wait(int id) {
+  std::unique_ptr<Impl::Playing> state;
+  {
+    std::lock_guard lock(impl_->mutex);
+    auto found = impl_->playing.find(id);
+    if (found == impl_->playing.end())
+      throw std::runtime_error("no such replayed child");
+    state = std::move(found->second);
+    impl_->playing.erase(found);
+  }
+  state->player.join();
+  return state->code;
+}
+
+void ReplayBackend::kill(int id) {
+  Impl::Playing *state;
+  {
+    std::lock_guard lock(impl_->mutex);
+    auto found = impl_->playing.find(id);
+    if (found == impl_->playing.end())
+      return;
+    state = found->second.get();
+  }
+  Impl::stop(*state);
+}
+
+void ReplayBackend::release(int id) {
+  std::lock_guard lock(impl_->mutex);
+  impl_->reclaim();
+  auto found = impl_->playing.find(id);
+  if (found == impl_->playing.end())
+    return;
+  // it plays on, as an unwaited process runs on, and is joined once done
+  impl_->released.push_back(std::move(found->second));
+  impl_->playing.erase(found);
+}
+
 
 } // namespace process
 
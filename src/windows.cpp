@@ -8,6 +8,7 @@
 #include <span>
 #include <stdexcept>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include "process.hpp"
@@ -161,9 +162,9 @@ struct ExitStatus::Impl {
   Impl() : code(std::nullopt) {}
   Impl(int result) : code(result) {}
 };
-ExitStatus::ExitStatus() : impl_(std::make_unique<Impl>()) {}
+ExitStatus::ExitStatus() {}
 ExitStatus::~ExitStatus() = default;
-ExitStatus::ExitStatus(ExitStatus &&other) { *this = std::move(other); }
+ExitStatus::ExitStatus(ExitStatus &&other) : impl_(std::move(other.impl_)) {}
 ExitStatus &ExitStatus::operator=(ExitStatus &&other) {
   if (this != &other) {
     this->impl_ = std::move(other.impl_);
@@ -174,13 +175,34 @@ bool ExitStatus::success() { return impl_->code == 0; }
 optional<int> ExitStatus::code() { return impl_->code; }
 
 /*============================================================================*/
-struct ChildStdin::Impl {
+// handle closed when its owner goes away; moved-from owners hold nullptr
+struct OwnedHandle {
   HANDLE handle;
-  Impl(HANDLE h) : handle(h) {}
+  OwnedHandle(HANDLE h = nullptr) : handle(h) {}
+  OwnedHandle(OwnedHandle &&other)
+      : handle(std::exchange(other.handle, nullptr)) {}
+  OwnedHandle &operator=(OwnedHandle &&other) {
+    if (this != &other) {
+      reset();
+      handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+  }
+  ~OwnedHandle() { reset(); }
+  void reset() {
+    if (handle != nullptr)
+      CloseHandle(handle);
+    handle = nullptr;
+  }
+  HANDLE release() { return std::exchange(handle, nullptr); }
 };
-ChildStdin::ChildStdin() : impl_(nullptr) {}
+
+struct ChildStdin::Impl : OwnedHandle {
+  using OwnedHandle::OwnedHandle;
+};
+ChildStdin::ChildStdin() {}
 ChildStdin::~ChildStdin() {}
-ChildStdin::ChildStdin(ChildStdin &&other) { *this = std::move(other); }
+ChildStdin::ChildStdin(ChildStdin &&other) : impl_(std::move(other.impl_)) {}
 ChildStdin &ChildStdin::operator=(ChildStdin &&other) {
   if (this != &other)
     this->impl_ = std::move(other.impl_);
@@ -189,14 +211,14 @@ ChildStdin &ChildStdin::operator=(ChildStdin &&other) {
 size_t ChildStdin::write(span<const std::byte> buffer) {
   return Handle::write(impl_->handle, buffer);
 }
+native_handle_type ChildStdin::native_handle() const { return impl_->handle; }
 
-struct ChildStdout::Impl {
-  HANDLE handle;
-  Impl(HANDLE h) : handle(h) {}
+struct ChildStdout::Impl : OwnedHandle {
+  using OwnedHandle::OwnedHandle;
 };
-ChildStdout::ChildStdout() : impl_(nullptr) {}
+ChildStdout::ChildStdout() {}
 ChildStdout::~ChildStdout() {}
-ChildStdout::ChildStdout(ChildStdout &&other) { *this = std::move(other); }
+ChildStdout::ChildStdout(ChildStdout &&other) : impl_(std::move(other.impl_)) {}
 ChildStdout &ChildStdout::operator=(ChildStdout &&other) {
   if (this != &other)
     this->impl_ = std::move(other.impl_);
@@ -211,14 +233,14 @@ size_t ChildStdout::read_to_end(std::vector<std::byte> &buffer) {
 size_t ChildStdout::read_to_string(std::string &buffer) {
   return Handle::read_to_string(impl_->handle, buffer);
 }
+native_handle_type ChildStdout::native_handle() const { return impl_->handle; }
 
-struct ChildStderr::Impl {
-  HANDLE handle;
-  Impl(HANDLE h) : handle(h) {}
+struct ChildStderr::Impl : OwnedHandle {
+  using OwnedHandle::OwnedHandle;
 };
-ChildStderr::ChildStderr() : impl_(nullptr) {}
+ChildStderr::ChildStderr() {}
 ChildStderr::~ChildStderr() {}
-ChildStderr::ChildStderr(ChildStderr &&other) { *this = std::move(other); }
+ChildStderr::ChildStderr(ChildStderr &&other) : impl_(std::move(other.impl_)) {}
 ChildStderr &ChildStderr::operator=(ChildStderr &&other) {
   if (this != &other)
     this->impl_ = std::move(other.impl_);
@@ -233,12 +255,13 @@ size_t ChildStderr::read_to_end(std::vector<std::byte> &buffer) {
 size_t ChildStderr::read_to_string(std::string &buffer) {
   return Handle::read_to_string(impl_->handle, buffer);
 }
+native_handle_type ChildStderr::native_handle() const { return impl_->handle; }
 
 /*============================================================================*/
 struct Stdio::Impl {
   Value value;
-  Impl(Value v) : value(v), other(nullptr) {}
-  HANDLE other;
+  Impl(Value v = Value::Inherit) : value(v), other() {}
+  OwnedHandle other; // relayed to the child by the next spawn
   //        parent, handle
   // stdin: write, read
   // stdout: read, write
@@ -247,7 +270,7 @@ struct Stdio::Impl {
     switch (value) {
     case Value::Inherit: {
       if (id == 0)
-        return {GetStdHandle(STD_INPUT_HANDLE), nullptr};
+        return {nullptr, GetStdHandle(STD_INPUT_HANDLE)};
       else if (id == 1)
         return {nullptr, GetStdHandle(STD_OUTPUT_HANDLE)};
       else if (id == 2)
@@ -267,7 +290,7 @@ struct Stdio::Impl {
     }
     case Value::FromPipe: {
       if (id == 0)
-        return spawn_pipe_relay(other, true, true);
+        return spawn_pipe_relay(other.handle, true, true);
       else if (id == 1)
         return {nullptr, nullptr};
       else if (id == 2)
@@ -292,9 +315,9 @@ struct Stdio::Impl {
   }
 };
 
-Stdio::Stdio(Value v) : impl_(std::make_unique<Impl>(v)) {}
+Stdio::Stdio(Value v) { impl_->value = v; }
 Stdio::~Stdio() = default;
-Stdio::Stdio(Stdio &&other) { *this = std::move(other); };
+Stdio::Stdio(Stdio &&other) : impl_(std::move(other.impl_)) {}
 Stdio &Stdio::operator=(Stdio &&other) {
   if (&other != this)
     this->impl_ = std::move(other.impl_);
@@ -307,30 +330,36 @@ Stdio Stdio::inherit() { return Stdio(Value::Inherit); }
 Stdio Stdio::null() { return Stdio(Value::Null); }
 Stdio Stdio::from(ChildStdin other) {
   Stdio io = Stdio(Value::FromPipe);
-  io.impl_->other = other.impl_->handle;
+  io.impl_->other = std::move(*other.impl_);
   return io;
 }
 Stdio Stdio::from(ChildStdout other) {
   Stdio io = Stdio(Value::FromPipe);
-  io.impl_->other = other.impl_->handle;
+  io.impl_->other = std::move(*other.impl_);
   return io;
 }
 Stdio Stdio::from(ChildStderr other) {
   Stdio io = Stdio(Value::FromPipe);
-  io.impl_->other = other.impl_->handle;
+  io.impl_->other = std::move(*other.impl_);
   return io;
 }
 
 /*============================================================================*/
 struct Child::Impl {
   Process pi;
-  Impl(Process pi) : pi(std::move(pi)) {}
+  Impl() : pi(PROCESS_INFORMATION{}) {}
 };
-Child::Child() : impl_(nullptr){};
-Child::~Child(){};
-Child::Child(Child &&other) { *this = std::move(other); };
+Child::Child() {}
+Child::~Child() {}
+Child::Child(Child &&other)
+    : io_stdin(std::move(other.io_stdin)),
+      io_stdout(std::move(other.io_stdout)),
+      io_stderr(std::move(other.io_stderr)), impl_(std::move(other.impl_)) {}
 Child &Child::operator=(Child &&other) {
   if (&other != this) {
+    this->io_stdin = std::move(other.io_stdin);
+    this->io_stdout = std::move(other.io_stdout);
+    this->io_stderr = std::move(other.io_stderr);
     this->impl_ = std::move(other.impl_);
   }
   return *this;
@@ -338,6 +367,7 @@ Child &Child::operator=(Child &&other) {
 
 int Child::id() { return impl_->pi.id(); }
 ExitStatus Child::wait() {
+  io_stdin.reset(); // a child reading stdin to the end would never exit
   int code = impl_->pi.wait();
   ExitStatus status;
   status.impl_->code = code;
@@ -345,6 +375,7 @@ ExitStatus Child::wait() {
 }
 void Child::kill() { impl_->pi.kill(); }
 Output Child::wait_with_output() {
+  io_stdin.reset();
   Output output;
   if (io_stdout and not io_stderr) {
     this->io_stdout->read_to_string(output.std_out);
@@ -388,7 +419,7 @@ public:
     }
     app = find_exe_path(name.string());
   }
-  void add_args(const string &arg) { args.push_back(arg); }
+  void add_args(std::string_view arg) { args.emplace_back(arg); }
   void set_stdin(Stdio io) { io_stdin = std::move(io); }
   void set_stdout(Stdio io) { io_stdout = std::move(io); }
   void set_stderr(Stdio io) { io_stderr = std::move(io); }
@@ -487,19 +518,19 @@ public:
     }
     Child s;
     if (our_stdin != nullptr) {
-      s.io_stdin = std::make_optional<ChildStdin>();
-      s.io_stdin->impl_ = std::make_unique<ChildStdin::Impl>(our_stdin);
+      s.io_stdin.emplace();
+      s.io_stdin->impl_->handle = our_stdin;
     }
     if (our_stdout != nullptr) {
-      s.io_stdout = std::make_optional<ChildStdout>();
-      s.io_stdout->impl_ = std::make_unique<ChildStdout::Impl>(our_stdout);
+      s.io_stdout.emplace();
+      s.io_stdout->impl_->handle = our_stdout;
     }
     if (our_stderr != nullptr) {
-      s.io_stderr = std::make_optional<ChildStderr>();
-      s.io_stderr->impl_ = std::make_unique<ChildStderr::Impl>(our_stderr);
+      s.io_stderr.emplace();
+      s.io_stderr->impl_->handle = our_stderr;
     }
 
-    s.impl_ = std::make_unique<Child::Impl>(Process(pi));
+    s.impl_->pi = Process(pi);
     return s;
   }
 };
@@ -517,12 +548,12 @@ Command &Command::operator=(Command &&other) {
   return *this;
 }
 
-Command &&Command::arg(const string &arg) {
+Command &&Command::arg(std::string_view arg) {
   impl_->add_args(arg);
   return std::move(*this);
 }
-Command &&Command::args(const vector<string> &args) {
-  for (const string &arg : args)
+Command &&Command::args(std::initializer_list<std::string_view> args) {
+  for (auto arg : args)
     impl_->add_args(arg);
   return std::move(*this);
 }
@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace process;
+
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { std::free(ptr); }
+
+#ifndef _WIN32
+TEST(AllocationTest, StatusSteadyState) {
+  Command command("sh");
+  command.arg("-c").arg("exit 0");
+  ASSERT_TRUE(command.status().success()); // sizes argv and stdio storage
+
+  size_t before = allocations.load();
+  bool success = true;
+  for (int i = 0; i < 16; i += 1) {
+    ExitStatus status = command.status();
+    success = success && status.success();
+  }
+  size_t count = allocations.load() - before;
+  EXPECT_TRUE(success);
+  EXPECT_EQ(count, 0u);
+}
+
+TEST(AllocationTest, StaticCommandStatus) {
+  using Exit = StaticCommand<"sh", "-c", "exit $0">;
+  ASSERT_TRUE(Exit::status("0").success());
+
+  size_t before = allocations.load();
+  bool success = true;
+  for (int i = 0; i < 16; i += 1)
+    success = success && Exit::status("0").success();
+  EXPECT_TRUE(success);
+  EXPECT_EQ(allocations.load() - before, 0u);
+}
+
+TEST(AllocationTest, CaptureIntoFixedBuffer) {
+  Child child = Command("sh")
+                    .args({"-c", "head -c 200000 /dev/zero; echo err >&2"})
+                    .std_out(Stdio::pipe())
+                    .std_err(Stdio::pipe())
+                    .spawn();
+  static std::byte out_storage[256 * 1024], err_storage[64];
+  FixedBuffer out(out_storage), err(err_storage);
+  size_t before = allocations.load();
+  ExitStatus status = child.wait_with_output(out, err);
+  EXPECT_EQ(allocations.load() - before, 0u);
+  EXPECT_TRUE(status.success());
+  EXPECT_EQ(out.size(), 200000u);
+  EXPECT_EQ(err.view(), "err\n");
+}
+
+TEST(AllocationTest, HandlesAreInline) {
+  size_t before = allocations.load();
+  {
+    ExitStatus status;
+    ChildStdin in;
+    ChildStdout out;
+    ChildStderr err;
+    Stdio io = Stdio::pipe();
+    Stdio moved = std::move(io);
+  }
+  EXPECT_EQ(allocations.load() - before, 0u);
+}
+#endif
@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <list>
+
+using namespace process;
+using std::string;
+using std::vector;
+
+#ifndef _WIN32
+// mock "out" echoes its arguments separated by spaces
+TEST(ArgsTest, StringView) {
+  std::string_view word = "hello world";
+  Output output = Command("./mock").arg("out").arg(word.substr(0, 5)).output();
+  EXPECT_STREQ(output.std_out.c_str(), "hello ");
+}
+
+TEST(ArgsTest, CharPointerArray) {
+  const char *argv[] = {"out", "a", "b", "c"};
+  Output output = Command("./mock").args(argv).output();
+  EXPECT_STREQ(output.std_out.c_str(), "a b c ");
+
+  std::span<const char *const> tail(argv + 1, 2);
+  output = Command("./mock").arg("out").args(tail).output();
+  EXPECT_STREQ(output.std_out.c_str(), "a b ");
+}
+
+TEST(ArgsTest, Ranges) {
+  std::list<string> words = {"out", "x", "y"};
+  Output output = Command("./mock").args(words).output();
+  EXPECT_STREQ(output.std_out.c_str(), "x y ");
+
+  output = Command("./mock").args({"out", "z"}).output();
+  EXPECT_STREQ(output.std_out.c_str(), "z ");
+}
+
+TEST(ArgsTest, ManyArguments) {
+  vector<string> files;
+  for (int i = 0; i < 5000; i += 1)
+    files.push_back("file" + std::to_string(i));
+  Output output = Command("sh")
+                      .arg("-c")
+                      .arg("echo $# $1 ${5000}")
+                      .arg("sh")
+                      .args(files)
+                      .output();
+  EXPECT_STREQ(output.std_out.c_str(), "5000 file0 file4999\n");
+}
+
+TEST(ArgsTest, EmptyAndNul) {
+  Output output = Command("sh").args({"-c", "echo $#", "sh", "", ""}).output();
+  EXPECT_STREQ(output.std_out.c_str(), "2\n");
+  EXPECT_THROW(Command("sh").arg(std::string_view("a\0b", 3)),
+               std::runtime_error);
+}
+#endif
@@ -0,0 +1,201 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+#include "scratch.hpp"
+
+#include <chrono>
+#include <thread>
+
+using namespace process;
+using std::string;
+using Clock = std::chrono::steady_clock;
+
+#ifndef _WIN32
+static void record(const string &trace, const std::function<void()> &workload) {
+  Backend::install(std::make_shared<RecordingBackend>(trace));
+  workload();
+  Backend::install(nullptr);
+}
+
+// counts spawns and hands them on to fork and exec
+class CountingBackend : public UnixBackend {
+public:
+  int spawns = 0;
+  Child spawn(const SpawnRequest &request) override {
+    spawns += 1;
+    return UnixBackend::spawn(request);
+  }
+};
+
+// hands out real children whose wait and kill come back to the backend
+class AdoptingBackend : public UnixBackend {
+public:
+  Child spawn(const SpawnRequest &request) override {
+    return adopt(spawn_unix(request));
+  }
+};
+
+TEST(BackendTest, InstalledBackendSeesSpawns) {
+  auto counting = std::make_shared<CountingBackend>();
+  Backend::install(counting);
+  EXPECT_EQ(Command("echo").arg("hi").output().std_out, "hi\n");
+  EXPECT_TRUE(Command("true").status().success());
+  EXPECT_EQ(counting->spawns, 2);
+  Backend::install(nullptr);
+  Command("true").status();
+  EXPECT_EQ(counting->spawns, 2);
+}
+
+TEST(BackendTest, RecordThenReplay) {
+  ScratchDir dir;
+  string trace = dir / "trace";
+  string input = "some input\n";
+  record(trace, [&] {
+    Output output =
+        Command("sh").args({"-c", "echo out; echo err >&2; exit 3"}).output();
+    EXPECT_EQ(output.std_out, "out\n");
+    EXPECT_EQ(output.status.code(), 3);
+    Output echoed = Command("cat").output_with_input(std::as_bytes(std::span{input}));
+    EXPECT_EQ(echoed.std_out, input);
+  });
+
+  Backend::install(std::make_shared<ReplayBackend>(trace, 0));
+  Output output =
+      Command("sh").args({"-c", "echo out; echo err >&2; exit 3"}).output();
+  EXPECT_EQ(output.std_out, "out\n");
+  EXPECT_EQ(output.std_err, "err\n");
+  EXPECT_EQ(output.status.code(), 3);
+  Output echoed = Command("cat").output_with_input(std::as_bytes(std::span{input}));
+  EXPECT_EQ(echoed.std_out, input);
+  EXPECT_TRUE(echoed.status.success());
+  // each recorded run plays once
+  EXPECT_THROW(Command("cat").output(), std::runtime_error);
+  Backend::install(nullptr);
+}
+
+TEST(BackendTest, ReplaySpeed) {
+  ScratchDir dir;
+  string trace = dir / "trace";
+  record(trace, [] {
+    Command("sh").args({"-c", "sleep 0.3; echo done"}).output();
+  });
+
+  Backend::install(std::make_shared<ReplayBackend>(trace, 1.0));
+  auto start = Clock::now();
+  EXPECT_EQ(Command("sh").args({"-c", "sleep 0.3; echo done"}).output().std_out,
+            "done\n");
+  EXPECT_GE(Clock::now() - start, std::chrono::milliseconds(250));
+
+  Backend::install(std::make_shared<ReplayBackend>(trace, 100.0));
+  start = Clock::now();
+  EXPECT_EQ(Command("sh").args({"-c", "sleep 0.3; echo done"}).output().std_out,
+            "done\n");
+  EXPECT_LT(Clock::now() - start, std::chrono::milliseconds(200));
+  Backend::install(nullptr);
+}
+
+TEST(BackendTest, KillReplayedChild) {
+  ScratchDir dir;
+  string trace = dir / "trace";
+  record(trace, [] { Command("sleep").arg("0.3").status(); });
+  Backend::install(std::make_shared<ReplayBackend>(trace));
+  auto start = Clock::now();
+  Child child = Command("sleep").arg("0.3").spawn();
+  EXPECT_EQ(child.id(), -1); // no process behind it
+  child.kill();
+  EXPECT_FALSE(child.wait().code());
+  EXPECT_LT(Clock::now() - start, std::chrono::milliseconds(250));
+  Backend::install(nullptr);
+}
+
+TEST(BackendTest, RecordedChildKeepsItsPid) {
+  ScratchDir dir;
+  record(dir / "trace", [] {
+    Child child =
+        Command("sh").args({"-c", "echo $$"}).std_out(Stdio::pipe()).spawn();
+    int pid = child.id();
+    Output output = child.wait_with_output();
+    EXPECT_EQ(output.std_out, std::to_string(pid) + "\n");
+  });
+}
+
+TEST(BackendTest, GraphUnderReplay) {
+  ScratchDir dir;
+  string trace = dir / "trace";
+  auto run = [] {
+    Graph graph;
+    auto first = graph.add(Command("sh").args({"-c", "exit 0"}));
+    auto second = graph.add(Command("sh").args({"-c", "exit 2"}));
+    auto third = graph.add(Command("true"));
+    graph.depends(second, first);
+    graph.depends(third, second);
+    return graph.run(2);
+  };
+  record(trace, [&] { run(); });
+  Backend::install(std::make_shared<ReplayBackend>(trace, 0));
+  auto start = Clock::now();
+  auto results = run();
+  EXPECT_LT(Clock::now() - start, std::chrono::seconds(5));
+  EXPECT_EQ(results[0].state, NodeState::Succeeded);
+  EXPECT_EQ(results[1].state, NodeState::Failed);
+  EXPECT_EQ(results[1].exit_code, 2);
+  EXPECT_EQ(results[2].state, NodeState::Cancelled);
+  Backend::install(nullptr);
+}
+
+TEST(BackendTest, AdoptedRealChildrenWithReaper) {
+  Reaper::start();
+  Backend::install(std::make_shared<AdoptingBackend>());
+  EXPECT_EQ(Command("sh").args({"-c", "exit 4"}).status().code(), 4);
+  Child child = Command("sleep").arg("10").spawn();
+  EXPECT_GT(child.id(), 0);
+  child.kill();
+  EXPECT_EQ(child.wait().code(), std::nullopt);
+  Backend::install(nullptr);
+}
+
+TEST(BackendTest, DroppedAdoptedChildrenAreReleased) {
+  // with the reaper running each child the backend keeps holds a pidfd
+  Reaper::start();
+  auto open_fds = [] {
+    auto fds = std::filesystem::directory_iterator("/proc/self/fd");
+    return std::distance(begin(fds), end(fds));
+  };
+  Backend::install(std::make_shared<AdoptingBackend>());
+  auto fds = open_fds();
+  for (int i = 0; i < 20; i += 1) {
+    Child child = Command("sleep").arg("10").spawn();
+    child.kill();
+  }
+  // the reaper lets go of its own watches as it collects the children
+  auto deadline = Clock::now() + std::chrono::seconds(5);
+  while (open_fds() != fds && Clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  EXPECT_EQ(open_fds(), fds);
+  Backend::install(nullptr);
+}
+
+TEST(BackendTest, ReplayDestroyedWhileOutputUnread) {
+  ScratchDir dir;
+  string trace = dir / "trace";
+  string script = "head -c 1000000 /dev/zero";
+  record(trace, [&] { Command("sh").args({"-c", script}).output(); });
+  auto replay = std::make_shared<ReplayBackend>(trace, 0);
+  Backend::install(replay);
+  std::optional<ChildStdout> out;
+  {
+    Child child =
+        Command("sh").args({"-c", script}).std_out(Stdio::pipe()).spawn();
+    out = std::move(child.io_stdout);
+  }
+  Backend::install(nullptr);
+  // the player is stuck on a full pipe nobody reads
+  auto start = Clock::now();
+  replay.reset();
+  EXPECT_LT(Clock::now() - start, std::chrono::seconds(2));
+}
+
+TEST(BackendTest, NotATrace) {
+  EXPECT_THROW(ReplayBackend("/dev/null"), std::runtime_error);
+}
+#endif
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <chrono>
+#include <ranges>
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+// prints how many arguments each invocation got
+static Command count_args() {
+  return Command("sh").args({"-c", "echo $#", "sh"});
+}
+
+static std::vector<string> numbered(size_t count, size_t width = 1) {
+  std::vector<string> args;
+  for (size_t i = 0; i < count; i += 1) {
+    string arg = std::to_string(i);
+    args.push_back(string(width > arg.size() ? width - arg.size() : 0, '0') + arg);
+  }
+  return args;
+}
+
+TEST(BatchTest, MaxArgs) {
+  auto args = numbered(1000);
+  auto outputs = for_each_batch(Command("echo"), args, {.max_args = 300});
+  ASSERT_EQ(outputs.size(), 4u);
+  string joined;
+  for (auto &output : outputs) {
+    EXPECT_TRUE(output.status.success());
+    joined += output.std_out;
+  }
+  string expected;
+  for (size_t i = 0; i < 1000; i += 1)
+    expected += std::to_string(i) + (i % 300 == 299 || i == 999 ? "\n" : " ");
+  EXPECT_EQ(joined, expected);
+}
+
+TEST(BatchTest, ByteLimit) {
+  auto args = numbered(5000, 10);
+  auto outputs = for_each_batch(count_args(), args, {.max_bytes = 1 << 16});
+  EXPECT_GT(outputs.size(), 1u);
+  size_t total = 0;
+  for (auto &output : outputs)
+    total += std::stoul(output.std_out);
+  EXPECT_EQ(total, 5000u);
+}
+
+TEST(BatchTest, SystemLimitAvoidsE2BIG) {
+  // a few megabytes of arguments, more than one execve takes
+  auto args = numbered(150000, 24);
+  auto outputs = for_each_batch(count_args(), args);
+  EXPECT_GT(outputs.size(), 1u);
+  size_t total = 0;
+  for (auto &output : outputs) {
+    EXPECT_TRUE(output.status.success());
+    total += std::stoul(output.std_out);
+  }
+  EXPECT_EQ(total, args.size());
+}
+
+TEST(BatchTest, ParallelInOrder) {
+  std::vector<string> delays{"0.3", "0.1", "0.2"};
+  auto start = std::chrono::steady_clock::now();
+  auto outputs = for_each_batch(
+      Command("sh").args({"-c", "sleep $1; echo $1", "sh"}), delays,
+      {.max_args = 1, .parallelism = 3});
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(550));
+  ASSERT_EQ(outputs.size(), 3u);
+  for (size_t i = 0; i < delays.size(); i += 1)
+    EXPECT_EQ(outputs[i].std_out, delays[i] + "\n");
+}
+
+TEST(BatchTest, FailedBatchKeepsGoing) {
+  std::vector<string> codes{"0", "3", "0"};
+  auto outputs = for_each_batch(Command("sh").args({"-c", "exit $1", "sh"}), codes,
+                                {.max_args = 1, .parallelism = 1});
+  ASSERT_EQ(outputs.size(), 3u);
+  EXPECT_EQ(outputs[1].status.code(), 3);
+  EXPECT_TRUE(outputs[2].status.success());
+}
+
+TEST(BatchTest, GeneratedRange) {
+  auto args = std::views::iota(0, 5) |
+              std::views::transform([](int i) { return std::to_string(i); });
+  auto outputs = for_each_batch(Command("echo"), args);
+  ASSERT_EQ(outputs.size(), 1u);
+  EXPECT_EQ(outputs[0].std_out, "0 1 2 3 4\n");
+}
+
+TEST(BatchTest, ArgumentTooLong) {
+  std::vector<string> args{"a", string(300000, 'x')};
+  EXPECT_THROW(for_each_batch(Command("echo"), args), std::runtime_error);
+  EXPECT_TRUE(for_each_batch(Command("echo"), std::vector<string>{}).empty());
+}
+#endif
@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+using namespace process;
+using std::string;
+using std::vector;
+
+#ifndef _WIN32
+static std::span<const std::byte> bytes(const string &str) {
+  return std::as_bytes(std::span{str});
+}
+
+TEST(BufferedStdinTest, ManySmallRecords) {
+  Child child = Command("./mock")
+                    .args({"in", "1000"})
+                    .std_in(Stdio::pipe())
+                    .std_out(Stdio::pipe())
+                    .spawn();
+  BufferedStdin in(std::move(*child.io_stdin), 256);
+  string expected;
+  for (int i = 0; i < 1000; i += 1) {
+    string record = std::to_string(i % 10) + "\n";
+    in.write_all(bytes(record));
+    expected += record.substr(0, 1);
+  }
+  in.close();
+  Output output = child.wait_with_output();
+  EXPECT_TRUE(output.status.success());
+  EXPECT_EQ(output.std_out, expected);
+}
+
+TEST(BufferedStdinTest, Writev) {
+  Child child = Command("cat")
+                    .std_in(Stdio::pipe())
+                    .std_out(Stdio::pipe())
+                    .spawn();
+  BufferedStdin in(std::move(*child.io_stdin), 4);
+  string a = "gather ", b = "write ", c(10000, 'x');
+  vector<std::span<const std::byte>> parts = {bytes(a), bytes(b), bytes(c)};
+  in.writev(parts);
+  in.write_all(bytes(a)); // left in the buffer until close
+  in.close();
+  Output output = child.wait_with_output();
+  EXPECT_EQ(output.std_out, a + b + c + a);
+}
+
+TEST(BufferedStdinTest, BrokenPipe) {
+  Child child = Command("true").std_in(Stdio::pipe()).spawn();
+  BufferedStdin in(std::move(*child.io_stdin), 16);
+  child.wait();
+  string chunk(1 << 16, 'x');
+  // the process survives: no SIGPIPE, an exception instead
+  EXPECT_THROW(
+      {
+        for (int i = 0; i < 64; i += 1)
+          in.write_all(bytes(chunk));
+        in.flush();
+      },
+      BrokenPipe);
+}
+#endif
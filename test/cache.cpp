@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+#include "scratch.hpp"
+
+#include <cstdlib>
+#include <fstream>
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+// every run appends to a counter file, so its length counts the spawns
+static Command counted(OutputCache &cache, const ScratchDir &dir,
+                       const string &text) {
+  string script =
+      "printf x >> " + dir / "runs" + "; echo " + text + "; echo e >&2";
+  return Command("sh").args({"-c", script}).cache(cache);
+}
+
+static size_t runs(const ScratchDir &dir) {
+  return read_file(dir / "runs").size();
+}
+
+TEST(CacheTest, HitSkipsSpawn) {
+  ScratchDir dir;
+  OutputCache cache(dir / "store");
+  Output first = counted(cache, dir, "hello").output();
+  Output second = counted(cache, dir, "hello").output();
+  EXPECT_EQ(runs(dir), 1u);
+  EXPECT_EQ(second.std_out, "hello\n");
+  EXPECT_EQ(second.std_err, "e\n");
+  EXPECT_EQ(second.status.code(), 0);
+  EXPECT_GT(cache.size_bytes(), 0u);
+}
+
+TEST(CacheTest, ExitCodeIsKept) {
+  ScratchDir dir;
+  OutputCache cache(dir / "store");
+  Command("sh").args({"-c", "exit 3"}).cache(cache).output();
+  Output output = Command("sh").args({"-c", "exit 3"}).cache(cache).output();
+  EXPECT_EQ(output.status.code(), 3);
+}
+
+TEST(CacheTest, KeyCoversArgs) {
+  ScratchDir dir;
+  OutputCache cache(dir / "store");
+  counted(cache, dir, "a").output();
+  Output output = counted(cache, dir, "b").output();
+  EXPECT_EQ(runs(dir), 2u);
+  EXPECT_EQ(output.std_out, "b\n");
+}
+
+TEST(CacheTest, KeyCoversSelectedEnv) {
+  ScratchDir dir;
+  OutputCache cache(dir / "store");
+  counted(cache, dir, "$V").env("V", "1").cache_env("V").output();
+  counted(cache, dir, "$V").env("V", "1").cache_env("V").output();
+  Output output = counted(cache, dir, "$V").env("V", "2").cache_env("V").output();
+  EXPECT_EQ(runs(dir), 2u);
+  EXPECT_EQ(output.std_out, "2\n");
+}
+
+TEST(CacheTest, KeyCoversExplicitEnv) {
+  // set on the command, so it is part of the key without cache_env
+  ScratchDir dir;
+  OutputCache cache(dir / "store");
+  counted(cache, dir, "$MODE").env("MODE", "a").output();
+  Output output = counted(cache, dir, "$MODE").env("MODE", "b").output();
+  EXPECT_EQ(runs(dir), 2u);
+  EXPECT_EQ(output.std_out, "b\n");
+  counted(cache, dir, "$MODE").env("MODE", "a").output();
+  EXPECT_EQ(runs(dir), 2u);
+}
+
+TEST(CacheTest, KeyCoversClearedEnv) {
+  ScratchDir dir;
+  OutputCache cache(dir / "store");
+  counted(cache, dir, "x").output();
+  counted(cache, dir, "x").env_clear().env("PATH", getenv("PATH")).output();
+  EXPECT_EQ(runs(dir), 2u);
+}
+
+TEST(CacheTest, KeyCoversWorkingDirectory) {
+  ScratchDir dir;
+  OutputCache cache(dir / "store");
+  std::filesystem::create_directories(dir / "a");
+  std::filesystem::create_directories(dir / "b");
+  string home = std::filesystem::current_path();
+  std::filesystem::current_path(dir / "a");
+  Output first = Command("pwd").cache(cache).output();
+  std::filesystem::current_path(dir / "b");
+  Output second = Command("pwd").cache(cache).output();
+  std::filesystem::current_path(home);
+  auto real = [](const string &path) {
+    return std::filesystem::canonical(path).string() + "\n";
+  };
+  EXPECT_EQ(first.std_out, real(dir / "a"));
+  EXPECT_EQ(second.std_out, real(dir / "b"));
+}
+
+TEST(CacheTest, KeyCoversProgramFoundOnPath) {
+  ScratchDir dir;
+  OutputCache cache(dir / "store");
+  for (string name : {"a", "b"}) {
+    std::filesystem::create_directories(dir / name);
+    std::ofstream(dir / name + "/tool") << "#!/bin/sh\necho " + name + "\n";
+    std::filesystem::permissions(dir / name + "/tool",
+                                 std::filesystem::perms::owner_all);
+  }
+  string path = getenv("PATH");
+  setenv("PATH", (dir / "a" + ":" + path).c_str(), 1);
+  Output first = Command("tool").cache(cache).output();
+  setenv("PATH", (dir / "b" + ":" + path).c_str(), 1);
+  Output second = Command("tool").cache(cache).output();
+  setenv("PATH", path.c_str(), 1);
+  EXPECT_EQ(first.std_out, "a\n");
+  EXPECT_EQ(second.std_out, "b\n");
+}
+
+TEST(CacheTest, KeyCoversInputContents) {
+  ScratchDir dir;
+  OutputCache cache(dir / "store");
+  string input = dir / "input";
+  std::ofstream(input) << "one";
+  counted(cache, dir, "$(cat " + input + ")").cache_input(input).output();
+  counted(cache, dir, "$(cat " + input + ")").cache_input(input).output();
+  std::ofstream(input) << "two";
+  Output output =
+      counted(cache, dir, "$(cat " + input + ")").cache_input(input).output();
+  EXPECT_EQ(runs(dir), 2u);
+  EXPECT_EQ(output.std_out, "two\n");
+}
+
+TEST(CacheTest, Eviction) {
+  ScratchDir dir;
+  OutputCache cache(dir / "store", 1024);
+  string big(400, 'x');
+  for (int i = 0; i < 8; i += 1)
+    Command("printf").args({big + std::to_string(i)}).cache(cache).output();
+  EXPECT_LE(cache.size_bytes(), 1024u);
+  // the most recent entry survives
+  Output output = counted(cache, dir, "new").output();
+  counted(cache, dir, "new").output();
+  EXPECT_EQ(runs(dir), 1u);
+  EXPECT_EQ(output.std_out, "new\n");
+}
+
+TEST(CacheTest, Clear) {
+  ScratchDir dir;
+  OutputCache cache(dir / "store");
+  counted(cache, dir, "a").output();
+  cache.clear();
+  EXPECT_EQ(cache.size_bytes(), 0u);
+  counted(cache, dir, "a").output();
+  EXPECT_EQ(runs(dir), 2u);
+}
+#endif
@@ -39,6 +39,5 @@ TEST(CmdTest, CommandNotFound) {
 #else
   string bin = "not_exist";
 #endif
-  // TODO:
-  // EXPECT_THROW(Command(bin).spawn(), std::runtime_error);
+  EXPECT_THROW(Command(bin).spawn(), std::runtime_error);
 }
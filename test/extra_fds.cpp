@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+static string read_all(int fd) {
+  string text;
+  char buffer[256];
+  ssize_t got;
+  while ((got = ::read(fd, buffer, sizeof(buffer))) > 0)
+    text.append(buffer, got);
+  return text;
+}
+
+TEST(ExtraFdsTest, ExtraOutPipe) {
+  Child child = Command("sh")
+                    .args({"-c", "echo side >&3; echo main"})
+                    .std_out(Stdio::pipe())
+                    .extra_out(3, Stdio::pipe())
+                    .spawn();
+  std::optional<ChildStdout> side = child.take_out(3);
+  ASSERT_TRUE(side);
+  EXPECT_FALSE(child.take_out(3));
+  string text;
+  side->read_to_string(text);
+  EXPECT_EQ(text, "side\n");
+  Output output = child.wait_with_output();
+  EXPECT_EQ(output.std_out, "main\n");
+}
+
+TEST(ExtraFdsTest, ExtraInPipe) {
+  Child child = Command("sh")
+                    .args({"-c", "cat <&4"})
+                    .std_out(Stdio::pipe())
+                    .extra_in(4, Stdio::pipe())
+                    .spawn();
+  {
+    std::optional<ChildStdin> control = child.take_in(4);
+    ASSERT_TRUE(control);
+    string message = "over fd 4";
+    control->write(std::as_bytes(std::span{message}));
+  } // closing our end ends the child's input
+  Output output = child.wait_with_output();
+  EXPECT_EQ(output.std_out, "over fd 4");
+}
+
+TEST(ExtraFdsTest, PassFd) {
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_CLOEXEC), 0);
+  Child child = Command("sh")
+                    .args({"-c", "echo passed >&5"})
+                    .pass_fd(fds[1], 5)
+                    .spawn();
+  close(fds[1]);
+  EXPECT_TRUE(child.wait().success());
+  EXPECT_EQ(read_all(fds[0]), "passed\n");
+  close(fds[0]);
+}
+
+TEST(ExtraFdsTest, CycleOfThree) {
+  // pipes whose write ends sit on three free fds here, rotated in the child
+  int readers[3], writers[3];
+  for (int i = 0; i < 3; i += 1) {
+    int fds[2];
+    ASSERT_EQ(pipe2(fds, O_CLOEXEC), 0);
+    readers[i] = fds[0];
+    writers[i] = fds[1];
+  }
+  int base = 200;
+  while (fcntl(base, F_GETFD) != -1 || fcntl(base + 1, F_GETFD) != -1 ||
+         fcntl(base + 2, F_GETFD) != -1)
+    base += 3;
+  for (int i = 0; i < 3; i += 1) {
+    ASSERT_EQ(dup3(writers[i], base + i, O_CLOEXEC), base + i);
+    close(writers[i]);
+  }
+  string script;
+  for (int i = 0; i < 3; i += 1)
+    script += "echo " + std::to_string(i) + " > /dev/fd/" +
+              std::to_string(base + i) + ";";
+  Child child = Command("sh")
+                    .args({"-c", script})
+                    .pass_fd(base, base + 1)
+                    .pass_fd(base + 1, base + 2)
+                    .pass_fd(base + 2, base)
+                    .spawn();
+  for (int i = 0; i < 3; i += 1)
+    close(base + i);
+  EXPECT_TRUE(child.wait().success());
+  EXPECT_EQ(read_all(readers[0]), "1\n"); // our first fd became its second
+  EXPECT_EQ(read_all(readers[1]), "2\n");
+  EXPECT_EQ(read_all(readers[2]), "0\n");
+  for (int fd : readers)
+    close(fd);
+}
+
+TEST(ExtraFdsTest, SwapWithStdout) {
+  // stdout and fd 3 trade places
+  int fds[2];
+  ASSERT_EQ(pipe2(fds, O_CLOEXEC), 0);
+  Child child = Command("sh")
+                    .args({"-c", "echo to-3 >&3; echo to-1"})
+                    .std_out(Stdio::pipe())
+                    .pass_fd(fds[1], 3)
+                    .spawn();
+  close(fds[1]);
+  Output output = child.wait_with_output();
+  EXPECT_EQ(output.std_out, "to-1\n");
+  EXPECT_EQ(read_all(fds[0]), "to-3\n");
+  close(fds[0]);
+}
+
+TEST(ExtraFdsTest, LaterIdentityMappingWins) {
+  // fd already in place is named again after another mapping onto it
+  int first[2], second[2];
+  ASSERT_EQ(pipe2(first, O_CLOEXEC), 0);
+  ASSERT_EQ(pipe2(second, O_CLOEXEC), 0);
+  int target = 200;
+  while (fcntl(target, F_GETFD) != -1)
+    target += 1;
+  ASSERT_EQ(dup3(second[1], target, O_CLOEXEC), target);
+  close(second[1]);
+  Child child = Command("sh")
+                    .args({"-c", "echo last > /dev/fd/" + std::to_string(target)})
+                    .pass_fd(first[1], target)
+                    .pass_fd(target, target)
+                    .spawn();
+  close(first[1]);
+  close(target);
+  EXPECT_TRUE(child.wait().success());
+  EXPECT_EQ(read_all(second[0]), "last\n");
+  EXPECT_EQ(read_all(first[0]), "");
+  close(first[0]);
+  close(second[0]);
+}
+
+TEST(ExtraFdsTest, InvalidTarget) {
+  EXPECT_THROW(Command("true").extra_out(1, Stdio::pipe()), std::runtime_error);
+  EXPECT_THROW(Command("true").pass_fd(0, -1), std::runtime_error);
+}
+#endif
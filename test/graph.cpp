@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+#include "scratch.hpp"
+
+#include <chrono>
+
+using namespace process;
+using std::string;
+using namespace std::chrono_literals;
+
+#ifndef _WIN32
+// a node that appends its name to the log
+static Command step(const string &log, const string &name) {
+  return Command("sh").args({"-c", "echo " + name + " >> " + log});
+}
+
+TEST(GraphTest, DependenciesOrderNodes) {
+  ScratchDir dir;
+  string log = dir / "log";
+  Graph graph;
+  auto c = graph.add(step(log, "c"));
+  auto b = graph.add(step(log, "b"));
+  auto a = graph.add(step(log, "a"));
+  graph.depends(b, a);
+  graph.depends(c, b);
+  auto results = graph.run(4);
+  EXPECT_EQ(read_file(log), "a\nb\nc\n");
+  for (auto &result : results) {
+    EXPECT_EQ(result.state, NodeState::Succeeded);
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_GE(result.elapsed(), std::chrono::steady_clock::duration::zero());
+  }
+}
+
+TEST(GraphTest, RunsIndependentNodesInParallel) {
+  Graph graph;
+  for (int i = 0; i < 3; i += 1)
+    graph.add(Command("sleep").arg("0.3"));
+  auto start = std::chrono::steady_clock::now();
+  graph.run(3);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 800ms);
+}
+
+TEST(GraphTest, ParallelismLimit) {
+  Graph graph;
+  for (int i = 0; i < 3; i += 1)
+    graph.add(Command("sleep").arg("0.1"));
+  auto start = std::chrono::steady_clock::now();
+  graph.run(1);
+  EXPECT_GE(std::chrono::steady_clock::now() - start, 300ms);
+}
+
+TEST(GraphTest, FailureCancelsDownstream) {
+  ScratchDir dir;
+  string log = dir / "log";
+  Graph graph;
+  auto bad = graph.add(Command("sh").args({"-c", "exit 4"}));
+  auto after = graph.add(step(log, "after"));
+  auto last = graph.add(step(log, "last"));
+  auto other = graph.add(step(log, "other"));
+  graph.depends(after, bad);
+  graph.depends(last, after);
+  auto results = graph.run(2);
+  EXPECT_EQ(results[bad].state, NodeState::Failed);
+  EXPECT_EQ(results[bad].exit_code, 4);
+  EXPECT_EQ(results[after].state, NodeState::Cancelled);
+  EXPECT_EQ(results[last].state, NodeState::Cancelled);
+  EXPECT_EQ(results[other].state, NodeState::Succeeded);
+  EXPECT_EQ(read_file(log), "other\n");
+}
+
+TEST(GraphTest, SpawnFailureCountsAsFailure) {
+  ScratchDir dir;
+  string log = dir / "log";
+  Graph graph;
+  auto missing = graph.add(Command("/nonexistent/program"));
+  auto after = graph.add(step(log, "after"));
+  graph.depends(after, missing);
+  auto results = graph.run();
+  EXPECT_EQ(results[missing].state, NodeState::Failed);
+  EXPECT_FALSE(results[missing].exit_code);
+  EXPECT_EQ(results[after].state, NodeState::Cancelled);
+}
+
+TEST(GraphTest, SpawnFailureInPipeline) {
+  ScratchDir dir;
+  string log = dir / "log";
+  Graph graph;
+  auto source = graph.add(Command("sh").args({"-c", "sleep 10; echo x"}));
+  auto missing = graph.add(Command("/nonexistent/program"));
+  auto sink = graph.add(step(log, "sink"));
+  graph.pipe(source, missing);
+  graph.pipe(missing, sink);
+  auto start = std::chrono::steady_clock::now();
+  auto results = graph.run(3);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 5s);
+  EXPECT_EQ(results[source].state, NodeState::Failed); // killed
+  EXPECT_EQ(results[missing].state, NodeState::Failed);
+  EXPECT_EQ(results[sink].state, NodeState::Failed); // never started
+  EXPECT_EQ(read_file(log), "");
+}
+
+TEST(GraphTest, PipeEdge) {
+  ScratchDir dir;
+  string log = dir / "log";
+  Graph graph;
+  auto sink = graph.add(Command("sh").args({"-c", "sort >> " + log}));
+  auto source = graph.add(Command("printf").arg("b\\na\\nc\\n"));
+  auto done = graph.add(step(log, "done"));
+  graph.pipe(source, sink);
+  graph.depends(done, sink);
+  auto results = graph.run(2);
+  EXPECT_EQ(results[source].state, NodeState::Succeeded);
+  EXPECT_EQ(results[sink].state, NodeState::Succeeded);
+  EXPECT_EQ(read_file(log), "a\nb\nc\ndone\n");
+}
+
+TEST(GraphTest, CriticalPathFirst) {
+  ScratchDir dir;
+  string log = dir / "log";
+  Graph graph;
+  graph.add(step(log, "short"), 10ms);
+  auto head = graph.add(step(log, "head"), 100ms);
+  auto tail = graph.add(step(log, "tail"), 100ms);
+  graph.depends(tail, head);
+  graph.run(1);
+  EXPECT_EQ(read_file(log), "head\ntail\nshort\n");
+}
+
+TEST(GraphTest, RejectsCycles) {
+  ScratchDir dir;
+  string log = dir / "log";
+  Graph graph;
+  auto a = graph.add(step(log, "a"));
+  auto b = graph.add(step(log, "b"));
+  graph.depends(a, b);
+  graph.depends(b, a);
+  EXPECT_THROW(graph.run(), std::runtime_error);
+  EXPECT_THROW(graph.depends(a, a), std::runtime_error);
+  EXPECT_THROW(graph.depends(a, 7), std::runtime_error);
+}
+#endif
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <filesystem>
+#include <sys/wait.h>
+
+using namespace process;
+using std::string;
+using std::vector;
+
+#ifndef _WIN32
+TEST(InputTest, LargeInputThroughFilter) {
+  // far more than a pipe buffer in both directions
+  string input;
+  for (int i = 0; i < 200000; i += 1)
+    input += std::to_string(i % 1000) + "\n";
+  Output output = Command("cat").output_with_input(std::as_bytes(std::span{input}));
+  EXPECT_TRUE(output.status.success());
+  EXPECT_EQ(output.std_out.size(), input.size());
+  EXPECT_TRUE(output.std_out == input);
+}
+
+TEST(InputTest, StreamingSource) {
+  int lines = 0;
+  Output output = Command("sh")
+                      .args({"-c", "wc -l; echo done >&2"})
+                      .output_with_input([&](std::span<std::byte> buffer) {
+                        if (lines == 50000)
+                          return size_t(0);
+                        lines += 1;
+                        buffer[0] = std::byte{'\n'};
+                        return size_t(1);
+                      });
+  EXPECT_TRUE(output.status.success());
+  EXPECT_EQ(std::stoi(output.std_out), 50000);
+  EXPECT_STREQ(output.std_err.c_str(), "done\n");
+}
+
+TEST(InputTest, ChildIgnoresInput) {
+  string input(1 << 20, 'x');
+  Output output = Command("sh")
+                      .args({"-c", "echo early"})
+                      .output_with_input(std::as_bytes(std::span{input}));
+  EXPECT_TRUE(output.status.success());
+  EXPECT_STREQ(output.std_out.c_str(), "early\n");
+}
+
+static size_t open_fds() {
+  auto fds = std::filesystem::directory_iterator("/proc/self/fd");
+  return std::distance(begin(fds), end(fds));
+}
+
+TEST(InputTest, FailingSourceReleasesChild) {
+  size_t fds = open_fds();
+  int calls = 0;
+  EXPECT_THROW(Command("cat").output_with_input([&](std::span<std::byte> buffer) {
+    if (++calls == 3)
+      throw std::runtime_error("source failed");
+    buffer[0] = std::byte{'x'};
+    return size_t(1);
+  }),
+               std::runtime_error);
+  // the pipes are closed and the child is killed and reaped
+  EXPECT_EQ(open_fds(), fds);
+  EXPECT_EQ(waitpid(-1, nullptr, WNOHANG), -1);
+  EXPECT_EQ(errno, ECHILD);
+}
+
+TEST(InputTest, StdinNotPiped) {
+  string input = "x";
+  EXPECT_THROW(Command("cat").std_in(Stdio::null()).output_with_input(
+                   std::as_bytes(std::span{input})),
+               std::runtime_error);
+}
+#endif
@@ -3,6 +3,12 @@
 #include <iostream>
 #include <string>
 
+#ifndef _WIN32
+#include "../src/shm_channel.hpp"
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
 using std::cerr;
 using std::cin;
 using std::cout;
@@ -44,6 +50,82 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+#ifndef _WIN32
+  if (string(argv[1]) == "shm_echo") { // copy a shm channel stdin to stdout
+    process::shm::Reader in(0);
+    process::shm::Writer out(1);
+    std::byte buffer[3000];
+    while (size_t got = in.read(buffer))
+      out.write(std::span{buffer, got});
+    return 0;
+  }
+#endif
+
+#ifndef _WIN32
+  // sd_notify client: starting, ready, then beats WATCHDOG=1 heartbeats
+  // interval ms apart before hanging; negative beats send WATCHDOG=trigger
+  if (string(argv[1]) == "notify") {
+    assert(argc >= 4);
+    int beats = atoi(argv[2]), interval = atoi(argv[3]);
+    const char *address = getenv("NOTIFY_SOCKET");
+    if (not address)
+      return 2;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    size_t length = strlen(address);
+    memcpy(addr.sun_path, address, length);
+    if (address[0] == '@')
+      addr.sun_path[0] = '\0'; // abstract namespace
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    auto send = [&](const string &message) {
+      sendto(fd, message.data(), message.size(), 0,
+             reinterpret_cast<sockaddr *>(&addr),
+             offsetof(sockaddr_un, sun_path) + length);
+    };
+    send("STATUS=starting");
+    usleep(50 * 1000);
+    send("READY=1\nSTATUS=serving");
+    if (beats < 0)
+      send("WATCHDOG=trigger");
+    for (int beat = 0; beat < beats; beat += 1) {
+      usleep(interval * 1000);
+      send("WATCHDOG=1");
+    }
+    sleep(30); // stuck
+    return 0;
+  }
+#endif
+
+  if (string(argv[1]) == "echo_lines") { // answer every line until eof
+    string line;
+    while (getline(cin, line)) {
+      if (line == "crash")
+        return 3;
+#ifndef _WIN32
+      if (line == "pid") {
+        cout << getpid() << std::endl;
+        continue;
+      }
+#endif
+      cout << "echo:" << line << std::endl;
+    }
+    return 0;
+  }
+
+  if (string(argv[1]) == "echo_frames") { // 4-byte big-endian length frames
+    unsigned char prefix[4];
+    while (cin.read(reinterpret_cast<char *>(prefix), 4)) {
+      size_t len = size_t(prefix[0]) << 24 | prefix[1] << 16 | prefix[2] << 8 |
+                   prefix[3];
+      string payload(len, '\0');
+      cin.read(payload.data(), len);
+      cout.write(reinterpret_cast<char *>(prefix), 4);
+      cout.write(payload.data(), len);
+      cout.flush();
+    }
+    return 0;
+  }
+
   // stdio mode
   int value = strtol(argv[1], nullptr, 2);
   if (value <= 0 or value > 7) {
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <poll.h>
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+TEST(NonblockingTest, TryRead) {
+  Child child = Command("sh")
+                    .args({"-c", "read line; echo got $line"})
+                    .std_in(Stdio::pipe())
+                    .std_out(Stdio::pipe())
+                    .spawn();
+  child.io_stdout->set_nonblocking();
+  std::byte buffer[64];
+  IoResult nothing = child.io_stdout->try_read(buffer);
+  ASSERT_FALSE(nothing);
+  EXPECT_EQ(nothing.error(), IoError::WouldBlock);
+
+  string line = "ping\n";
+  EXPECT_EQ(child.io_stdin->try_write(std::as_bytes(std::span{line})).value(),
+            line.size());
+
+  string received;
+  while (true) {
+    pollfd fd{child.io_stdout->native_handle(), POLLIN, 0};
+    ASSERT_EQ(poll(&fd, 1, 5000), 1);
+    IoResult got = child.io_stdout->try_read(buffer);
+    if (not got) {
+      if (got.error() == IoError::Eof)
+        break;
+      ASSERT_EQ(got.error(), IoError::WouldBlock);
+      continue;
+    }
+    received.append(reinterpret_cast<char *>(buffer), *got);
+  }
+  EXPECT_EQ(received, "got ping\n");
+  EXPECT_TRUE(child.wait().success());
+}
+
+TEST(NonblockingTest, TryWriteFullPipe) {
+  Child child = Command("sleep").arg("5").std_in(Stdio::pipe()).spawn();
+  child.io_stdin->set_nonblocking();
+  string chunk(4096, 'x');
+  size_t total = 0;
+  IoResult result = size_t(0);
+  while ((result = child.io_stdin->try_write(std::as_bytes(std::span{chunk}))))
+    total += *result;
+  EXPECT_EQ(result.error(), IoError::WouldBlock);
+  EXPECT_GT(total, 0u);
+  child.kill();
+  child.wait();
+}
+
+TEST(NonblockingTest, TryWriteClosedPipe) {
+  Child child = Command("true").std_in(Stdio::pipe()).spawn();
+  ChildStdin in = std::move(*child.io_stdin);
+  child.wait();
+  string data = "x";
+  IoResult result = in.try_write(std::as_bytes(std::span{data}));
+  ASSERT_FALSE(result);
+  EXPECT_EQ(result.error(), IoError::Eof);
+  EXPECT_THROW(result.value(), std::runtime_error);
+}
+#endif
@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <chrono>
+#include <thread>
+
+using namespace process;
+using std::string;
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+#ifndef _WIN32
+static Child notifier(int beats, int interval_ms,
+                      std::chrono::microseconds watchdog = {}) {
+  return Command("./mock")
+      .args({"notify", std::to_string(beats), std::to_string(interval_ms)})
+      .notify_socket(watchdog)
+      .spawn();
+}
+
+TEST(Notify, WaitReady) {
+  Child child = notifier(0, 0);
+  auto start = Clock::now();
+  EXPECT_TRUE(child.wait_ready(5s));
+  EXPECT_LT(Clock::now() - start, 2s);
+  child.kill();
+  child.wait();
+}
+
+TEST(Notify, StatusMessagesInOrder) {
+  Child child = notifier(0, 0);
+  ASSERT_TRUE(child.wait_ready(5s));
+  auto first = child.next_notification(1s);
+  ASSERT_TRUE(first);
+  EXPECT_EQ(first->value("STATUS"), "starting");
+  EXPECT_EQ(first->pid, child.id());
+  auto second = child.next_notification(1s);
+  ASSERT_TRUE(second);
+  EXPECT_EQ(second->value("READY"), "1");
+  EXPECT_EQ(second->value("STATUS"), "serving");
+  EXPECT_FALSE(second->value("MAINPID"));
+  EXPECT_FALSE(child.next_notification(50ms));
+  child.kill();
+  child.wait();
+}
+
+TEST(Notify, ExitWithoutReady) {
+  Child child = Command("true").notify_socket().spawn();
+  auto start = Clock::now();
+  EXPECT_FALSE(child.wait_ready(5s));
+  EXPECT_LT(Clock::now() - start, 2s);
+  EXPECT_FALSE(child.next_notification(5s));
+  child.wait();
+}
+
+TEST(Notify, WatchdogExpiresWhenHeartbeatsStop) {
+  Child child = notifier(3, 50, 200ms);
+  ASSERT_TRUE(child.wait_ready(5s));
+  // heartbeats keep it alive for about 150ms
+  EXPECT_FALSE(child.watchdog_expired());
+  auto start = Clock::now();
+  while (not child.watchdog_expired() && Clock::now() - start < 5s)
+    std::this_thread::sleep_for(10ms);
+  EXPECT_TRUE(child.watchdog_expired());
+  EXPECT_GE(Clock::now() - start, 250ms);
+  child.kill();
+  EXPECT_FALSE(child.wait().success());
+}
+
+TEST(Notify, WatchdogTrigger) {
+  Child child = notifier(-1, 0);
+  ASSERT_TRUE(child.wait_ready(5s));
+  auto start = Clock::now();
+  while (not child.watchdog_expired() && Clock::now() - start < 5s)
+    std::this_thread::sleep_for(10ms);
+  EXPECT_TRUE(child.watchdog_expired());
+  child.kill();
+  child.wait();
+}
+
+TEST(Notify, NoWatchdogByDefault) {
+  Child child = notifier(0, 0);
+  ASSERT_TRUE(child.wait_ready(5s));
+  std::this_thread::sleep_for(50ms);
+  EXPECT_FALSE(child.watchdog_expired());
+  child.kill();
+  child.wait();
+}
+
+TEST(Notify, Environment) {
+  Output output = Command("sh")
+                      .args({"-c", "echo $NOTIFY_SOCKET; echo $WATCHDOG_USEC"})
+                      .notify_socket(1500ms)
+                      .output();
+  EXPECT_EQ(output.std_out.substr(0, 16), "@process-notify/");
+  EXPECT_NE(output.std_out.find("\n1500000\n"), string::npos);
+  // each spawn gets its own socket
+  EXPECT_NE(Command("sh")
+                .args({"-c", "echo $NOTIFY_SOCKET"})
+                .notify_socket()
+                .output()
+                .std_out,
+            output.std_out.substr(0, output.std_out.find('\n') + 1));
+}
+
+TEST(Notify, SpawnMany) {
+  std::vector<Command> commands;
+  commands.push_back(Command("./mock").args({"notify", "0", "0"}).notify_socket());
+  commands.push_back(Command("./mock").args({"notify", "0", "0"}).notify_socket());
+  auto children = spawn_many(commands);
+  for (Child &child : children) {
+    EXPECT_TRUE(child.wait_ready(5s));
+    child.kill();
+    child.wait();
+  }
+}
+
+TEST(Notify, WithoutSocket) {
+  Child child = Command("true").spawn();
+  EXPECT_THROW(child.wait_ready(1s), std::runtime_error);
+  child.wait();
+}
+#endif
@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+using namespace process;
+using std::string;
+using std::vector;
+using Args = vector<string>;
+
+#ifndef _WIN32
+TEST(PlacementTest, CpuAffinity) {
+  Args args = {"-c", "grep Cpus_allowed_list /proc/self/status"};
+  Output output = Command("sh").args(args).cpu_affinity({0}).output();
+  EXPECT_TRUE(output.status.success());
+  EXPECT_NE(output.std_out.find(":\t0\n"), string::npos) << output.std_out;
+}
+
+TEST(PlacementTest, CpuAffinityInvalid) {
+  EXPECT_THROW(Command("true").cpu_affinity({-1}), std::runtime_error);
+  // cpu that does not exist on this machine, reported back from the child
+  EXPECT_THROW(Command("true").cpu_affinity({CPU_SETSIZE - 1}).spawn(),
+               std::runtime_error);
+}
+
+TEST(PlacementTest, Nice) {
+  Output output = Command("nice").nice(5).output();
+  EXPECT_TRUE(output.status.success());
+  EXPECT_STREQ(output.std_out.c_str(), "5\n");
+}
+
+TEST(PlacementTest, SchedPolicy) {
+  Args args = {"-c", "grep policy /proc/self/sched | tr -d ' '"};
+  Output batch =
+      Command("sh").args(args).sched_policy(SchedPolicy::Batch).output();
+  EXPECT_STREQ(batch.std_out.c_str(), "policy:3\n");
+  Output idle = Command("sh").args(args).sched_policy(SchedPolicy::Idle).output();
+  EXPECT_STREQ(idle.std_out.c_str(), "policy:5\n");
+}
+
+TEST(PlacementTest, IoPriority) {
+  Output output =
+      Command("ionice").ioprio(IoPriority::BestEffort, 6).output();
+  EXPECT_TRUE(output.status.success());
+  EXPECT_STREQ(output.std_out.c_str(), "best-effort: prio 6\n");
+}
+
+TEST(PlacementTest, NumaSpread) {
+  NumaSpread spread;
+  ASSERT_FALSE(spread.nodes().empty());
+  for (size_t i = 0; i < spread.nodes().size() + 1; i += 1) {
+    ExitStatus status = spread.place(Command("true")).status();
+    EXPECT_TRUE(status.success());
+  }
+}
+#endif
@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+static string contents(int fd) {
+  string text;
+  char chunk[4096];
+  ssize_t got;
+  lseek(fd, 0, SEEK_SET);
+  while ((got = read(fd, chunk, sizeof(chunk))) > 0)
+    text.append(chunk, got);
+  return text;
+}
+
+static Child seq(int count) {
+  return Command("seq").arg(std::to_string(count)).std_out(Stdio::pipe()).spawn();
+}
+
+static string seq_text(int count) {
+  string text;
+  for (int i = 1; i <= count; i += 1)
+    text += std::to_string(i) + "\n";
+  return text;
+}
+
+TEST(PumpTest, IntoFileBySplice) {
+  FILE *file = tmpfile();
+  Child child = seq(20000);
+  PumpStats stats = pump(*child.io_stdout, fileno(file));
+  child.wait();
+  EXPECT_EQ(stats.bytes, seq_text(20000).size());
+  EXPECT_EQ(stats.copied, 0u);
+  EXPECT_GT(stats.calls, 0u);
+  EXPECT_EQ(contents(fileno(file)), seq_text(20000));
+  fclose(file);
+}
+
+TEST(PumpTest, AppendModeFallsBackToCopy) {
+  FILE *file = tmpfile();
+  int fd = open(("/proc/self/fd/" + std::to_string(fileno(file))).c_str(),
+                O_WRONLY | O_APPEND);
+  ASSERT_NE(fd, -1);
+  Child child = seq(1000);
+  PumpStats stats = pump(*child.io_stdout, fd);
+  child.wait();
+  EXPECT_EQ(stats.bytes, seq_text(1000).size());
+  EXPECT_EQ(stats.copied, stats.bytes);
+  EXPECT_EQ(contents(fileno(file)), seq_text(1000));
+  close(fd);
+  fclose(file);
+}
+
+TEST(PumpTest, Limit) {
+  FILE *file = tmpfile();
+  Child child = seq(1000);
+  PumpStats stats = pump(*child.io_stdout, fileno(file), 10);
+  EXPECT_EQ(stats.bytes, 10u);
+  EXPECT_EQ(contents(fileno(file)), seq_text(1000).substr(0, 10));
+  child.io_stdout.reset();
+  child.wait();
+  fclose(file);
+}
+
+TEST(PumpTest, ChildToChildAsync) {
+  Child producer = seq(5000);
+  Child consumer = Command("wc")
+                       .arg("-l")
+                       .std_in(Stdio::pipe())
+                       .std_out(Stdio::pipe())
+                       .spawn();
+  auto done = pump_async(std::move(*producer.io_stdout),
+                         std::move(*consumer.io_stdin));
+  producer.io_stdout.reset();
+  consumer.io_stdin.reset();
+  PumpStats stats = done.get();
+  EXPECT_EQ(stats.bytes, seq_text(5000).size());
+  string counted;
+  consumer.io_stdout->read_to_string(counted);
+  EXPECT_EQ(std::stoi(counted), 5000);
+  producer.wait();
+  consumer.wait();
+}
+
+TEST(PumpTest, SpillFileBySendfile) {
+  Output spilled =
+      Command("seq").arg("20000").spill_threshold(1000).output();
+  ASSERT_TRUE(spilled.std_out_file);
+  SpillFile &from = *spilled.std_out_file;
+  std::byte head[6];
+  ASSERT_EQ(from.read(head), 6u); // "1\n2\n3\n"
+  FILE *file = tmpfile();
+  PumpStats stats = pump(from, fileno(file));
+  string rest = seq_text(20000).substr(6);
+  EXPECT_EQ(stats.bytes, rest.size());
+  EXPECT_EQ(stats.copied, 0u);
+  EXPECT_EQ(contents(fileno(file)), rest);
+  // the read position moved past what was sent
+  EXPECT_EQ(from.read(head), 0u);
+  fclose(file);
+}
+
+TEST(PumpTest, SpillFileIntoAppendModeCopies) {
+  Output spilled = Command("seq").arg("2000").spill_threshold(100).output();
+  ASSERT_TRUE(spilled.std_out_file);
+  FILE *file = tmpfile();
+  int fd = open(("/proc/self/fd/" + std::to_string(fileno(file))).c_str(),
+                O_WRONLY | O_APPEND);
+  ASSERT_NE(fd, -1);
+  PumpStats stats = pump(*spilled.std_out_file, fd);
+  EXPECT_EQ(stats.copied, stats.bytes);
+  EXPECT_EQ(contents(fileno(file)), seq_text(2000));
+  close(fd);
+  fclose(file);
+}
+
+TEST(PumpTest, SpillFileIntoChild) {
+  Output spilled =
+      Command("seq").arg("20000").spill_threshold(1000).output();
+  ASSERT_TRUE(spilled.std_out_file);
+  Child consumer = Command("wc")
+                       .arg("-l")
+                       .std_in(Stdio::pipe())
+                       .std_out(Stdio::pipe())
+                       .spawn();
+  PumpStats stats = pump(*spilled.std_out_file, *consumer.io_stdin);
+  EXPECT_EQ(stats.bytes, seq_text(20000).size());
+  Output counted = consumer.wait_with_output();
+  EXPECT_EQ(std::stoi(counted.std_out), 20000);
+}
+
+TEST(PumpTest, ClosedDestination) {
+  Child producer = seq(100000);
+  Child consumer = Command("true").std_in(Stdio::pipe()).spawn();
+  ChildStdin in = std::move(*consumer.io_stdin);
+  consumer.wait();
+  EXPECT_THROW(pump(*producer.io_stdout, in), BrokenPipe);
+  producer.kill();
+  producer.wait();
+}
+#endif
@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <chrono>
+#include <csignal>
+#include <thread>
+
+using namespace process;
+using std::string;
+using std::vector;
+using Args = vector<string>;
+
+#ifndef _WIN32
+TEST(ReaperTest, WaitAsync) {
+  vector<Child> children;
+  for (int i = 0; i < 32; i += 1) {
+    Args args = {"-c", "exit " + std::to_string(i % 7)};
+    children.push_back(Command("sh").args(args).spawn());
+  }
+  vector<std::future<ExitStatus>> exits;
+  for (auto &child : children)
+    exits.push_back(child.wait_async());
+  for (int i = 0; i < 32; i += 1) {
+    ExitStatus status = exits[i].get();
+    EXPECT_EQ(status.code(), i % 7);
+  }
+}
+
+TEST(ReaperTest, KilledChild) {
+  Args args = {"-c", "sleep 10"};
+  Child child = Command("sh").args(args).spawn();
+  auto exit = child.wait_async();
+  child.kill();
+  ExitStatus status = exit.get();
+  EXPECT_FALSE(status.success());
+  EXPECT_EQ(status.code(), std::nullopt);
+  EXPECT_THROW(child.wait(), std::runtime_error);
+}
+
+TEST(ReaperTest, NoZombieWithoutWait) {
+  Reaper::start();
+  EXPECT_TRUE(Reaper::running());
+  pid_t pid;
+  {
+    Child child = Command("true").spawn();
+    pid = child.id();
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (::kill(pid, 0) == 0 && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  EXPECT_EQ(::kill(pid, 0), -1);
+
+  // children spawned while the reaper runs still complete Child::wait
+  Args args = {"-c", "exit 3"};
+  ExitStatus status = Command("sh").args(args).status();
+  EXPECT_EQ(status.code(), 3);
+}
+
+TEST(ReaperTest, KillAfterReaped) {
+  Reaper::start();
+  Child child = Command("true").spawn();
+  pid_t pid = child.id();
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (::kill(pid, 0) == 0 && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  // reaped in the background: the pid is free for reuse, so kill must not
+  // signal it, nor report an error for a child that is simply done
+  EXPECT_NO_THROW(child.kill());
+  EXPECT_TRUE(child.wait().success());
+  EXPECT_NO_THROW(child.kill());
+}
+#endif
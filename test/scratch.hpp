@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+// A fresh directory under the system temp dir, removed with its contents
+// when the test is done. Kept apart from the library under test, so cleanup
+// works even while spawning is broken or replaced by a Backend.
+struct ScratchDir {
+  std::string path;
+  ScratchDir() {
+    path = (std::filesystem::temp_directory_path() / "process-XXXXXX").string();
+    if (not mkdtemp(path.data()))
+      throw std::runtime_error("failed to create " + path);
+  }
+  ScratchDir(const ScratchDir &) = delete;
+  ScratchDir &operator=(const ScratchDir &) = delete;
+  ~ScratchDir() {
+    std::error_code ignored;
+    std::filesystem::remove_all(path, ignored);
+  }
+  std::string operator/(const std::string &name) const {
+    return path + "/" + name;
+  }
+};
+
+// whole contents of a file, empty when it does not exist
+inline std::string read_file(const std::string &path) {
+  std::ifstream file(path);
+  return std::string(std::istreambuf_iterator<char>(file), {});
+}
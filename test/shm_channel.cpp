@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+#include "shm_channel.hpp"
+
+#include <chrono>
+#include <thread>
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+TEST(ShmChannelTest, RoundTripThroughChild) {
+  // a ring far smaller than the payload forces wrap-around and waits on
+  // both sides
+  Child child = Command("./mock")
+                    .arg("shm_echo")
+                    .std_in(Stdio::shm_channel(4096))
+                    .std_out(Stdio::shm_channel(4096))
+                    .spawn();
+  shm::Writer to_child(child.io_stdin->native_handle());
+  shm::Reader from_child(child.io_stdout->native_handle());
+  EXPECT_EQ(to_child.capacity(), 4096u);
+
+  string input;
+  for (int i = 0; i < 100000; i += 1)
+    input += std::to_string(i) + "\n";
+  std::thread feeder([&] {
+    EXPECT_EQ(to_child.write(std::as_bytes(std::span{input})), input.size());
+    to_child.close();
+  });
+  string echoed;
+  std::byte buffer[5000];
+  while (size_t got = from_child.read(buffer))
+    echoed.append(reinterpret_cast<const char *>(buffer), got);
+  feeder.join();
+  EXPECT_TRUE(child.wait().success());
+  EXPECT_EQ(echoed.size(), input.size());
+  EXPECT_TRUE(echoed == input);
+}
+
+TEST(ShmChannelTest, ThroughWrapperWithStalls) {
+  // the ring's user is a grandchild, and the parent stalls past the
+  // bounded futex sleeps; neither may end the stream early
+  Child child = Command("sh")
+                    .args({"-c", "./mock shm_echo; exit $?"})
+                    .std_in(Stdio::shm_channel(4096))
+                    .std_out(Stdio::shm_channel(4096))
+                    .spawn();
+  shm::Writer to_child(child.io_stdin->native_handle());
+  shm::Reader from_child(child.io_stdout->native_handle());
+  std::thread feeder([&] {
+    for (string part : {"first\n", "second\n", "third\n"}) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(250));
+      to_child.write(std::as_bytes(std::span{part}));
+    }
+    to_child.close();
+  });
+  string echoed;
+  std::byte buffer[64];
+  while (size_t got = from_child.read(buffer))
+    echoed.append(reinterpret_cast<const char *>(buffer), got);
+  feeder.join();
+  EXPECT_TRUE(child.wait().success());
+  EXPECT_EQ(echoed, "first\nsecond\nthird\n");
+}
+
+TEST(ShmChannelTest, CapacityRoundsUp) {
+  Child child = Command("true").std_out(Stdio::shm_channel(5000)).spawn();
+  shm::Reader reader(child.io_stdout->native_handle());
+  EXPECT_EQ(reader.capacity(), 8192u);
+  child.wait();
+}
+
+TEST(ShmChannelTest, ChildExitWithoutCloseEndsStream) {
+  Child child = Command("true").std_out(Stdio::shm_channel()).spawn();
+  shm::Reader reader(child.io_stdout->native_handle());
+  std::byte buffer[16];
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(reader.read(buffer), 0u);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+  EXPECT_TRUE(child.wait().success());
+}
+
+TEST(ShmChannelTest, NotAChannel) {
+  EXPECT_THROW(shm::Reader(STDIN_FILENO), std::runtime_error);
+}
+#endif
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <memory_resource>
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+static Command both(const string &out, const string &err) {
+  return Command("sh").args({"-c", "printf '" + out + "'; printf '" + err + "' >&2"});
+}
+
+TEST(SinkTest, PmrContainers) {
+  // the arena has no upstream: any allocation beyond it throws
+  std::byte arena[16 * 1024];
+  std::pmr::monotonic_buffer_resource resource(arena, sizeof(arena),
+                                               std::pmr::null_memory_resource());
+  std::pmr::string out(&resource);
+  std::pmr::vector<std::byte> err(&resource);
+  ExitStatus status = both("to out", "to err").output(out, err);
+  EXPECT_TRUE(status.success());
+  EXPECT_EQ(out, "to out");
+  EXPECT_EQ(string(reinterpret_cast<const char *>(err.data()), err.size()),
+            "to err");
+}
+
+TEST(SinkTest, FixedBuffer) {
+  std::byte out_storage[64], err_storage[64];
+  FixedBuffer out(out_storage), err(err_storage);
+  Child child = both("hello", "world")
+                    .std_out(Stdio::pipe())
+                    .std_err(Stdio::pipe())
+                    .spawn();
+  EXPECT_TRUE(child.wait_with_output(out, err).success());
+  EXPECT_EQ(out.view(), "hello");
+  EXPECT_EQ(err.view(), "world");
+  EXPECT_FALSE(out.truncated());
+}
+
+TEST(SinkTest, FixedBufferTruncatesButDrains) {
+  // far more than a pipe buffer, so a stalled reader would deadlock
+  std::byte storage[100];
+  FixedBuffer out(storage);
+  string ignored;
+  ExitStatus status =
+      Command("sh").args({"-c", "head -c 1000000 /dev/zero"}).output(out, ignored);
+  EXPECT_TRUE(status.success());
+  EXPECT_EQ(out.size(), 100u);
+  EXPECT_TRUE(out.truncated());
+}
+
+TEST(SinkTest, StreamingCallback) {
+  size_t bytes = 0, chunks = 0;
+  auto count = [&](std::span<const std::byte> chunk) {
+    bytes += chunk.size();
+    chunks += 1;
+  };
+  string err;
+  ExitStatus status =
+      Command("sh").args({"-c", "head -c 300000 /dev/zero; echo e >&2"}).output(count, err);
+  EXPECT_TRUE(status.success());
+  EXPECT_EQ(bytes, 300000u);
+  EXPECT_GT(chunks, 1u);
+  EXPECT_EQ(err, "e\n");
+}
+
+TEST(SinkTest, ReadToEnd) {
+  Child child = Command("printf").arg("abc").std_out(Stdio::pipe()).spawn();
+  std::pmr::string text;
+  EXPECT_EQ(child.io_stdout->read_to_end(text), 3u);
+  EXPECT_EQ(text, "abc");
+  child.wait();
+}
+#endif
@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <cstdlib>
+#include <sched.h>
+#include <unistd.h>
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+struct Point {
+  int x;
+  double y;
+};
+
+TEST(SpawnFn, TriviallyCopyableResult) {
+  auto child = spawn_fn([](int x) { return Point{x * 2, 0.5}; }, 21);
+  EXPECT_GT(child.id(), 0);
+  Point point = child.get();
+  EXPECT_EQ(point.x, 42);
+  EXPECT_EQ(point.y, 0.5);
+}
+
+TEST(SpawnFn, RunsInAnotherProcess) {
+  int parent = getpid();
+  EXPECT_NE(spawn_fn([] { return getpid(); }).get(), parent);
+  int counter = 0;
+  spawn_fn([&] { counter += 1; }).get();
+  EXPECT_EQ(counter, 0);
+}
+
+TEST(SpawnFn, StringAndVectorResults) {
+  EXPECT_EQ(spawn_fn([] { return string(100000, 'x'); }).get(),
+            string(100000, 'x'));
+  auto numbers = spawn_fn([](int n) {
+                   std::vector<int> out;
+                   for (int i = 0; i < n; i += 1)
+                     out.push_back(i * i);
+                   return out;
+                 },
+                 5)
+                     .get();
+  EXPECT_EQ(numbers, (std::vector<int>{0, 1, 4, 9, 16}));
+  EXPECT_EQ(spawn_fn([] { return string(); }).get(), "");
+}
+
+TEST(SpawnFn, ExceptionIsRethrown) {
+  auto child = spawn_fn([]() -> int { throw std::runtime_error("boom"); });
+  try {
+    child.get();
+    FAIL();
+  } catch (const std::runtime_error &e) {
+    EXPECT_NE(string(e.what()).find("boom"), string::npos);
+  }
+}
+
+TEST(SpawnFn, CrashAndExitAreReported) {
+  EXPECT_THROW(spawn_fn([]() -> int { abort(); }).get(), std::runtime_error);
+  EXPECT_THROW(spawn_fn([]() -> int { _exit(4); }).get(), std::runtime_error);
+}
+
+TEST(SpawnFn, FailedReportStaysInTheChild) {
+  int parent = getpid();
+  auto child = spawn_fn([]() -> int {
+    for (int fd = 3; fd < 1024; fd += 1)
+      close(fd); // the report pipe too, so reporting the error fails
+    throw std::runtime_error("unreported");
+  });
+  if (getpid() != parent)
+    _exit(42); // the child came back out of spawn_fn
+  try {
+    child.get();
+    FAIL();
+  } catch (const std::runtime_error &e) {
+    EXPECT_NE(string(e.what()).find("code 1"), string::npos) << e.what();
+  }
+}
+
+TEST(SpawnFn, DroppedChildIsKilled) {
+  int pid;
+  {
+    auto child = spawn_fn([] {
+      pause();
+      return 0;
+    });
+    pid = child.id();
+  }
+  EXPECT_EQ(kill(pid, 0), -1); // reaped, so the pid is gone
+}
+
+TEST(SpawnFn, Affinity) {
+  cpu_set_t ours;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(ours), &ours), 0);
+  int cpu = 0;
+  while (not CPU_ISSET(cpu, &ours))
+    cpu += 1;
+  auto child = spawn_fn(FnOptions{{cpu}}, [] {
+    cpu_set_t set;
+    sched_getaffinity(0, sizeof(set), &set);
+    return CPU_COUNT(&set);
+  });
+  EXPECT_EQ(child.get(), 1);
+}
+
+TEST(ParallelMap, KeepsInputOrder) {
+  std::vector<int> inputs{5, 1, 4, 2, 3};
+  auto outputs = parallel_map(
+      inputs,
+      [](int n) {
+        usleep(n * 2000);
+        return n * 10;
+      },
+      3);
+  EXPECT_EQ(outputs, (std::vector<int>{50, 10, 40, 20, 30}));
+}
+
+TEST(ParallelMap, StringsWithDefaultWorkers) {
+  std::vector<string> words{"a", "bb", "ccc"};
+  auto outputs = parallel_map(words, [](const string &word) { return word + word; });
+  EXPECT_EQ(outputs, (std::vector<string>{"aa", "bbbb", "cccccc"}));
+}
+
+TEST(ParallelMap, FailurePropagates) {
+  std::vector<int> inputs{1, 2, 3};
+  EXPECT_THROW(parallel_map(inputs,
+                            [](int n) {
+                              if (n == 2)
+                                throw std::runtime_error("two");
+                              return n;
+                            }),
+               std::runtime_error);
+}
+#endif
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+#include "scratch.hpp"
+
+#include <fstream>
+
+using namespace process;
+using std::string;
+using std::vector;
+
+#ifndef _WIN32
+TEST(SpawnManyTest, Batch) {
+  vector<Command> commands;
+  for (int i = 0; i < 20; i += 1) {
+    commands.push_back(Command("sh")
+                           .args({"-c", "echo $ID $SHARED"})
+                           .env("ID", std::to_string(i))
+                           .env("SHARED", "same")
+                           .std_out(Stdio::pipe()));
+  }
+  vector<Child> children = spawn_many(commands);
+  ASSERT_EQ(children.size(), commands.size());
+  for (int i = 0; i < 20; i += 1) {
+    Output output = children[i].wait_with_output();
+    EXPECT_TRUE(output.status.success());
+    EXPECT_EQ(output.std_out, std::to_string(i) + " same\n");
+  }
+}
+
+TEST(SpawnManyTest, SharedImage) {
+  vector<Command> commands;
+  for (int i = 0; i < 8; i += 1)
+    commands.push_back(
+        Command("sh").args({"-c", "exit " + std::to_string(i)}).env_clear());
+  vector<Child> children = spawn_many(commands);
+  for (int i = 0; i < 8; i += 1)
+    EXPECT_EQ(children[i].wait().code(), i);
+}
+
+TEST(SpawnManyTest, RelativePathFromWorkingDirectory) {
+  // PATH=. names the child's working directory, not ours
+  ScratchDir dir;
+  std::ofstream(dir / "tool") << "#!/bin/sh\necho found\n";
+  std::filesystem::permissions(dir / "tool", std::filesystem::perms::owner_all);
+  vector<Command> commands;
+  for (int i = 0; i < 2; i += 1)
+    commands.push_back(Command("tool")
+                           .env("PATH", ".")
+                           .current_dir(dir.path)
+                           .std_out(Stdio::pipe()));
+  vector<Child> children = spawn_many(commands);
+  for (auto &child : children)
+    EXPECT_EQ(child.wait_with_output().std_out, "found\n");
+}
+
+TEST(SpawnManyTest, AllOrNothing) {
+  vector<Command> commands;
+  commands.push_back(Command("sleep").arg("10"));
+  commands.push_back(Command("not_exist"));
+  EXPECT_THROW(spawn_many(commands), std::runtime_error);
+}
+#endif
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+// 1 MiB of 'a' on stdout and a short line on stderr
+static Command big_writer() {
+  return Command("sh").args(
+      {"-c", "head -c 1048576 /dev/zero | tr '\\0' a; echo small >&2"});
+}
+
+TEST(SpillTest, BelowThresholdStaysInMemory) {
+  Output output =
+      Command("sh").args({"-c", "echo hi"}).spill_threshold(1024).output();
+  EXPECT_EQ(output.std_out, "hi\n");
+  EXPECT_FALSE(output.std_out_file);
+  EXPECT_FALSE(output.std_err_file);
+}
+
+TEST(SpillTest, SpillsPastThreshold) {
+  Output output = big_writer().spill_threshold(64 * 1024).output();
+  EXPECT_TRUE(output.status.success());
+  ASSERT_TRUE(output.std_out_file);
+  EXPECT_TRUE(output.std_out.empty());
+  EXPECT_EQ(output.std_out_file->size(), 1048576u);
+  std::string_view view = output.std_out_file->view();
+  EXPECT_EQ(view.size(), 1048576u);
+  EXPECT_EQ(view.find_first_not_of('a'), std::string_view::npos);
+  // the small stream is unaffected
+  EXPECT_FALSE(output.std_err_file);
+  EXPECT_EQ(output.std_err, "small\n");
+}
+
+TEST(SpillTest, StreamingRead) {
+  Output output = big_writer().spill_threshold(4096).output();
+  ASSERT_TRUE(output.std_out_file);
+  SpillFile &file = *output.std_out_file;
+  std::byte chunk[10000];
+  size_t total = 0, got;
+  while ((got = file.read(chunk)) > 0)
+    total += got;
+  EXPECT_EQ(total, 1048576u);
+  std::byte last[4];
+  EXPECT_EQ(file.read_at(1048574, last), 2u);
+  EXPECT_EQ(static_cast<char>(last[0]), 'a');
+}
+
+TEST(SpillTest, ChildWaitWithOutput) {
+  Child child = big_writer()
+                    .std_out(Stdio::pipe())
+                    .std_err(Stdio::pipe())
+                    .spawn();
+  Output output = child.wait_with_output(1024, "/tmp");
+  ASSERT_TRUE(output.std_out_file);
+  EXPECT_EQ(output.std_out_file->size(), 1048576u);
+}
+
+TEST(SpillTest, WithInput) {
+  string input(200000, 'b');
+  Output output = Command("cat").spill_threshold(1000).output_with_input(
+      std::as_bytes(std::span{input}));
+  ASSERT_TRUE(output.std_out_file);
+  EXPECT_EQ(output.std_out_file->view(), input);
+}
+#endif
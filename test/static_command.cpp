@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <cstring>
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+using Echo = StaticCommand<"sh", "-c", "echo \"$@\"; echo err >&2", "sh">;
+
+TEST(StaticCommandTest, ArgvIsConstant) {
+  static_assert(Echo::argv[4] == nullptr);
+  constexpr const char *const *argv = Echo::argv;
+  EXPECT_STREQ(argv[0], "sh");
+  EXPECT_STREQ(argv[3], "sh");
+}
+
+TEST(StaticCommandTest, Output) {
+  Output output = Echo::output();
+  EXPECT_TRUE(output.status.success());
+  EXPECT_EQ(output.std_out, "\n");
+  EXPECT_EQ(output.std_err, "err\n");
+}
+
+TEST(StaticCommandTest, RuntimeTail) {
+  string word = "two words";
+  Output output = Echo::output("one", word, string("three"));
+  EXPECT_EQ(output.std_out, "one two words three\n");
+}
+
+TEST(StaticCommandTest, Status) {
+  using Exit = StaticCommand<"sh", "-c", "exit $0">;
+  EXPECT_TRUE(Exit::status("0").success());
+  EXPECT_EQ(Exit::status("5").code(), 5);
+}
+
+TEST(StaticCommandTest, Spawn) {
+  Child child = StaticCommand<"true">::spawn();
+  EXPECT_FALSE(child.io_stdout);
+  EXPECT_TRUE(child.wait().success());
+}
+
+TEST(StaticCommandTest, MissingProgram) {
+  try {
+    StaticCommand<"/nonexistent/program">::status();
+    FAIL() << "spawned a missing program";
+  } catch (const std::runtime_error &error) {
+    EXPECT_NE(strstr(error.what(), "execvp failed"), nullptr);
+  }
+}
+#endif
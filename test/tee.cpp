@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+static string contents(int fd) {
+  string text;
+  char chunk[4096];
+  ssize_t got;
+  lseek(fd, 0, SEEK_SET);
+  while ((got = read(fd, chunk, sizeof(chunk))) > 0)
+    text.append(chunk, got);
+  return text;
+}
+
+static string seq_text(int count) {
+  string text;
+  for (int i = 1; i <= count; i += 1)
+    text += std::to_string(i) + "\n";
+  return text;
+}
+
+TEST(TeeTest, CaptureAndForward) {
+  FILE *log = tmpfile();
+  Output output = Command("seq")
+                      .arg("100000")
+                      .std_out(Stdio::tee(fileno(log)))
+                      .output();
+  EXPECT_TRUE(output.status.success());
+  EXPECT_EQ(output.std_out, seq_text(100000));
+  EXPECT_EQ(contents(fileno(log)), seq_text(100000));
+  fclose(log);
+}
+
+TEST(TeeTest, StderrToPipe) {
+  int log[2];
+  ASSERT_EQ(pipe(log), 0);
+  Output output = Command("sh")
+                      .args({"-c", "echo out; echo err >&2"})
+                      .std_err(Stdio::tee(log[1]))
+                      .output();
+  close(log[1]);
+  EXPECT_EQ(output.std_out, "out\n");
+  EXPECT_EQ(output.std_err, "err\n");
+  EXPECT_EQ(contents(log[0]), "err\n");
+  close(log[0]);
+}
+
+TEST(TeeTest, TargetWithoutSplice) {
+  FILE *log = tmpfile();
+  int fd = open(("/proc/self/fd/" + std::to_string(fileno(log))).c_str(),
+                O_WRONLY | O_APPEND);
+  ASSERT_NE(fd, -1);
+  Output output =
+      Command("seq").arg("2000").std_out(Stdio::tee(fd)).output();
+  close(fd);
+  EXPECT_EQ(output.std_out, seq_text(2000));
+  EXPECT_EQ(contents(fileno(log)), seq_text(2000));
+  fclose(log);
+}
+
+TEST(TeeTest, ForwardingOutlivesDroppedCapture) {
+  int log[2];
+  ASSERT_EQ(pipe(log), 0);
+  Child child = Command("seq").arg("50000").std_out(Stdio::tee(log[1])).spawn();
+  close(log[1]);
+  child.io_stdout.reset();
+  string forwarded = contents(log[0]);
+  EXPECT_TRUE(child.wait().success());
+  EXPECT_EQ(forwarded, seq_text(50000));
+  close(log[0]);
+}
+
+TEST(TeeTest, NonBlockingTargetIsWaitedFor) {
+  // the target pipe fills long before a slow reader gets to it
+  int log[2];
+  ASSERT_EQ(pipe(log), 0);
+  fcntl(log[1], F_SETFL, fcntl(log[1], F_GETFL) | O_NONBLOCK);
+  string forwarded;
+  std::thread reader([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    forwarded = contents(log[0]);
+  });
+  Output output =
+      Command("seq").arg("100000").std_out(Stdio::tee(log[1])).output();
+  close(log[1]);
+  reader.join();
+  close(log[0]);
+  EXPECT_EQ(output.std_out, seq_text(100000));
+  EXPECT_EQ(forwarded, seq_text(100000));
+}
+
+TEST(TeeTest, CaptureOutlivesClosedTarget) {
+  int log[2];
+  ASSERT_EQ(pipe(log), 0);
+  close(log[0]);
+  Output output =
+      Command("seq").arg("50000").std_out(Stdio::tee(log[1])).output();
+  close(log[1]);
+  EXPECT_TRUE(output.status.success());
+  EXPECT_EQ(output.std_out, seq_text(50000));
+}
+
+TEST(TeeTest, NotForStdin) {
+  EXPECT_THROW(Command("true").std_in(Stdio::tee(1)).spawn(), std::runtime_error);
+}
+#endif
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <chrono>
+#include <csignal>
+
+using namespace process;
+using std::string;
+using std::vector;
+using Args = vector<string>;
+using namespace std::chrono_literals;
+
+#ifndef _WIN32
+// first line written by the child, holding its background job's pid
+static pid_t read_pid(Child &child) {
+  string line;
+  std::byte ch;
+  while (child.io_stdout->read(std::span{&ch, 1}) == 1 &&
+         static_cast<char>(ch) != '\n')
+    line.push_back(static_cast<char>(ch));
+  return std::stoi(line);
+}
+
+TEST(TreeTest, ProcessGroup) {
+  Args args = {"-c", "ps -o pgid= -p $$"};
+  Child child = Command("sh").args(args).process_group().std_out(Stdio::pipe()).spawn();
+  int pid = child.id();
+  Output output = child.wait_with_output();
+  EXPECT_EQ(std::stoi(output.std_out), pid);
+}
+
+TEST(TreeTest, TerminateTree) {
+  set_child_subreaper();
+  Args args = {"-c", "sleep 30 & echo $!; wait"};
+  Child child = Command("sh")
+                    .args(args)
+                    .process_group()
+                    .std_out(Stdio::pipe())
+                    .spawn();
+  pid_t grandchild = read_pid(child);
+  auto start = std::chrono::steady_clock::now();
+  ExitStatus status = child.terminate_tree(2s);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 2s);
+  EXPECT_FALSE(status.success());
+  EXPECT_EQ(::kill(grandchild, 0), -1);
+  set_child_subreaper(false);
+}
+
+TEST(TreeTest, TerminateTreeEscalates) {
+  set_child_subreaper();
+  Args args = {"-c", "trap '' TERM; sleep 30 & echo $!; wait"};
+  Child child = Command("sh")
+                    .args(args)
+                    .new_session()
+                    .parent_death_signal(SIGKILL)
+                    .std_out(Stdio::pipe())
+                    .spawn();
+  pid_t grandchild = read_pid(child);
+  auto start = std::chrono::steady_clock::now();
+  ExitStatus status = child.terminate_tree(200ms);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_GE(elapsed, 200ms);
+  EXPECT_LT(elapsed, 2s);
+  EXPECT_EQ(status.code(), std::nullopt);
+  EXPECT_EQ(::kill(grandchild, 0), -1);
+  set_child_subreaper(false);
+}
+#endif
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <chrono>
+#include <regex>
+
+using namespace process;
+using std::string;
+using namespace std::chrono_literals;
+
+#ifndef _WIN32
+static Child server(const string &script) {
+  return Command("sh")
+      .args({"-c", script})
+      .std_out(Stdio::pipe())
+      .std_err(Stdio::pipe())
+      .spawn();
+}
+
+TEST(WaitForOutputTest, LiteralAcrossReads) {
+  Child child = server("printf star; sleep 0.1; printf 'ted on port 42\\nmore\\n'; "
+                       "sleep 0.5; echo done");
+  auto start = std::chrono::steady_clock::now();
+  auto line = child.wait_for_output("started", 5s);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 450ms);
+  ASSERT_TRUE(line);
+  EXPECT_EQ(*line, "started on port 42");
+  // everything read while waiting is still there
+  Output output = child.wait_with_output();
+  EXPECT_EQ(output.std_out, "started on port 42\nmore\ndone\n");
+}
+
+TEST(WaitForOutputTest, RegexOnStderr) {
+  Child child = server("echo noise; echo 'listening on :8080' >&2; sleep 0.5");
+  auto line = child.wait_for_output(OutputPattern::regex(":[0-9]+$"), 5s);
+  ASSERT_TRUE(line);
+  EXPECT_EQ(*line, "listening on :8080");
+  Output output = child.wait_with_output();
+  EXPECT_EQ(output.std_out, "noise\n");
+  EXPECT_EQ(output.std_err, "listening on :8080\n");
+}
+
+TEST(WaitForOutputTest, PredicateAndSuccessiveWaits) {
+  Child child = server("for i in 1 2 3 4; do echo step $i; done");
+  auto even = [](std::string_view line) {
+    return (line.back() - '0') % 2 == 0;
+  };
+  EXPECT_EQ(child.wait_for_output(OutputPattern::line(even), 5s), "step 2");
+  EXPECT_EQ(child.wait_for_output(OutputPattern::line(even), 5s), "step 4");
+  EXPECT_FALSE(child.wait_for_output(OutputPattern::line(even), 5s));
+  child.wait();
+}
+
+TEST(WaitForOutputTest, NextWaitResumesOnNextLine) {
+  // the same for every kind of pattern: a matched line is consumed whole
+  for (OutputPattern pattern :
+       {OutputPattern("ready"), OutputPattern::regex("ready")}) {
+    Child child = server("echo 'ready and ready'; echo ready again; sleep 0.5");
+    auto first = child.wait_for_output(pattern, 5s);
+    ASSERT_TRUE(first);
+    EXPECT_EQ(*first, "ready and ready");
+    auto second = child.wait_for_output(pattern, 5s);
+    ASSERT_TRUE(second);
+    EXPECT_EQ(*second, "ready again");
+    EXPECT_FALSE(child.wait_for_output(pattern, 100ms));
+    EXPECT_EQ(child.wait_with_output().std_out,
+              "ready and ready\nready again\n");
+  }
+}
+
+TEST(WaitForOutputTest, ReadsReturnBufferedBytesFirst) {
+  Child child = server("echo ready; echo rest");
+  ASSERT_TRUE(child.wait_for_output("ready", 5s));
+  EXPECT_GT(child.io_stdout->buffered(), 0u);
+  std::byte first[3];
+  ASSERT_EQ(child.io_stdout->read(first), 3u);
+  EXPECT_EQ(string(reinterpret_cast<char *>(first), 3), "rea");
+  string rest;
+  child.io_stdout->read_to_string(rest);
+  EXPECT_EQ(rest, "dy\nrest\n");
+  child.wait();
+}
+
+TEST(WaitForOutputTest, UnterminatedLastLine) {
+  Child child = server("printf 'no newline'");
+  EXPECT_EQ(child.wait_for_output(OutputPattern::regex("newline"), 5s), "no newline");
+  child.wait();
+}
+
+TEST(WaitForOutputTest, Timeout) {
+  Child child = server("echo quiet; sleep 5");
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(child.wait_for_output("ready", 100ms));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 2s);
+  child.kill();
+  Output output = child.wait_with_output();
+  EXPECT_EQ(output.std_out, "quiet\n");
+}
+
+TEST(WaitForOutputTest, BadRegex) {
+  EXPECT_THROW(OutputPattern::regex("("), std::regex_error);
+}
+#endif
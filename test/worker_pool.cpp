@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+#include "scratch.hpp"
+
+#include <chrono>
+#include <thread>
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+TEST(WorkerPoolTest, LineFraming) {
+  WorkerPool pool(Command("./mock").arg("echo_lines"), 2);
+  EXPECT_EQ(pool.size(), 2u);
+  EXPECT_EQ(pool.request("hello"), "echo:hello");
+  EXPECT_EQ(pool.request(""), "echo:");
+  EXPECT_THROW(pool.request("two\nlines"), std::runtime_error);
+  EXPECT_EQ(pool.respawns(), 0u);
+}
+
+TEST(WorkerPoolTest, LengthPrefixedFraming) {
+  WorkerPool pool(Command("./mock").arg("echo_frames"), 1,
+                  Framing::LengthPrefixed);
+  string binary("a\nb\0c", 5);
+  EXPECT_EQ(pool.request(binary), binary);
+  string large(300000, 'x'); // more than a pipe buffer each way
+  EXPECT_EQ(pool.request(large), large);
+  EXPECT_EQ(pool.request(""), "");
+}
+
+TEST(WorkerPoolTest, WorkersPersist) {
+  WorkerPool pool(Command("./mock").arg("echo_lines"), 1);
+  string pid = pool.request("pid");
+  for (int i = 0; i < 20; i += 1)
+    pool.request("x");
+  EXPECT_EQ(pool.request("pid"), pid);
+}
+
+TEST(WorkerPoolTest, CrashedWorkerIsReplaced) {
+  WorkerPool pool(Command("./mock").arg("echo_lines"), 1);
+  string pid = pool.request("pid");
+  EXPECT_THROW(pool.request("crash"), std::runtime_error);
+  EXPECT_EQ(pool.respawns(), 1u);
+  EXPECT_EQ(pool.request("again"), "echo:again");
+  EXPECT_NE(pool.request("pid"), pid);
+}
+
+TEST(WorkerPoolTest, CrashesWithReaperRunning) {
+  // the reaper may reap a crashed worker before it is stopped; that must
+  // not lose the pool's only slot
+  Reaper::start();
+  WorkerPool pool(Command("./mock").arg("echo_lines"), 1);
+  for (int i = 0; i < 3; i += 1)
+    EXPECT_THROW(pool.request("crash"), std::runtime_error);
+  EXPECT_EQ(pool.request("again"), "echo:again");
+}
+
+TEST(WorkerPoolTest, ResponseStreamedDuringRequest) {
+  // cat answers while it is still reading, far past both pipe buffers
+  WorkerPool pool(Command("cat"), 1);
+  string large(1 << 20, 'x');
+  EXPECT_EQ(pool.request(large), large);
+  EXPECT_EQ(pool.request("small"), "small");
+}
+
+TEST(WorkerPoolTest, WorkerIgnoringEndOfInput) {
+  auto start = std::chrono::steady_clock::now();
+  {
+    string script = "read line; echo \"$line\"; exec sleep 30";
+    WorkerPool pool(Command("sh").args({"-c", script}), 1, Framing::Line, 1);
+    EXPECT_EQ(pool.request("a"), "a"); // retires the worker
+    EXPECT_EQ(pool.request("b"), "b");
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+}
+
+TEST(WorkerPoolTest, MaxRequests) {
+  WorkerPool pool(Command("./mock").arg("echo_lines"), 1, Framing::Line, 2);
+  string first = pool.request("pid");
+  EXPECT_EQ(pool.request("pid"), first);
+  string second = pool.request("pid"); // served by the replacement
+  EXPECT_NE(second, first);
+  EXPECT_EQ(pool.respawns(), 1u);
+}
+
+TEST(WorkerPoolTest, ReplyKeptWhenReplacementFails) {
+  // a copy of the mock, removed once the first worker is running
+  ScratchDir dir;
+  string worker = dir / "worker";
+  std::filesystem::copy_file("./mock", worker);
+  WorkerPool pool(Command(worker).arg("echo_lines"), 1, Framing::Line, 1);
+  std::filesystem::remove(worker);
+  EXPECT_EQ(pool.request("a"), "echo:a"); // its replacement cannot start
+  EXPECT_THROW(pool.request("b"), std::runtime_error);
+  std::filesystem::copy_file("./mock", worker);
+  EXPECT_EQ(pool.request("c"), "echo:c");
+}
+
+TEST(WorkerPoolTest, ConcurrentRequests) {
+  WorkerPool pool(Command("./mock").arg("echo_lines"), 2);
+  std::vector<std::thread> threads;
+  std::atomic<int> wrong = 0;
+  for (int t = 0; t < 4; t += 1)
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 50; i += 1) {
+        string payload = std::to_string(t) + "-" + std::to_string(i);
+        if (pool.request(payload) != "echo:" + payload)
+          wrong += 1;
+      }
+    });
+  for (auto &thread : threads)
+    thread.join();
+  EXPECT_EQ(wrong, 0);
+}
+#endif
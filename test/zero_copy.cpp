@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include "process.hpp"
+
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+
+using namespace process;
+using std::string;
+
+#ifndef _WIN32
+// pass data through cat and read it back
+static string round_trip(const std::byte *data, size_t size) {
+  Child child = Command("cat")
+                    .std_in(Stdio::pipe())
+                    .std_out(Stdio::pipe())
+                    .spawn();
+  string received;
+  std::thread reader([&] { child.io_stdout->read_to_string(received); });
+  {
+    ChildStdin in = std::move(*child.io_stdin);
+    EXPECT_EQ(in.write_zero_copy(std::span{data, size}), size);
+  }
+  reader.join();
+  EXPECT_TRUE(child.wait().success());
+  return received;
+}
+
+class ZeroCopyTest : public ::testing::Test {
+protected:
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = 64 * page;
+  std::byte *buffer = nullptr;
+  void SetUp() override {
+    buffer = static_cast<std::byte *>(std::aligned_alloc(page, size));
+    for (size_t i = 0; i < size; i += 1)
+      buffer[i] = std::byte(i * 7 % 251);
+  }
+  void TearDown() override { std::free(buffer); }
+  string expected(size_t from, size_t count) {
+    return string(reinterpret_cast<char *>(buffer) + from, count);
+  }
+};
+
+TEST_F(ZeroCopyTest, AlignedBuffer) {
+  EXPECT_EQ(round_trip(buffer, size), expected(0, size));
+}
+
+TEST_F(ZeroCopyTest, UnalignedEdges) {
+  size_t from = 100, count = size - page - 37;
+  EXPECT_EQ(round_trip(buffer + from, count), expected(from, count));
+}
+
+TEST_F(ZeroCopyTest, SmallerThanAPage) {
+  EXPECT_EQ(round_trip(buffer + 5, 100), expected(5, 100));
+  EXPECT_EQ(round_trip(buffer, 0), "");
+}
+
+TEST_F(ZeroCopyTest, ClosedPipe) {
+  Child child = Command("true").std_in(Stdio::pipe()).spawn();
+  ChildStdin in = std::move(*child.io_stdin);
+  child.wait();
+  EXPECT_THROW(in.write_zero_copy(std::span{buffer, size}), BrokenPipe);
+}
+#endif